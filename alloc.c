@@ -0,0 +1,139 @@
+/*
+ * Memory allocation
+ *
+ * Every allocation of the library goes through the functions here and so
+ * through the allocator of the calling thread, see json_use_allocator, or else
+ * the one set with json_set_allocator.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "json.h"
+#include "alloc.h"
+
+static void *libc_malloc(size_t size, void *ctx);
+static void *libc_realloc(void *ptr, size_t size, void *ctx);
+static void  libc_free(void *ptr, void *ctx);
+
+static const json_allocator libc_allocator = { libc_malloc, libc_realloc, libc_free, NULL };
+
+static json_allocator global_allocator = { libc_malloc, libc_realloc, libc_free, NULL };
+static _Thread_local const json_allocator *thread_allocator = NULL;
+
+#define ALLOCATOR()    (thread_allocator ? thread_allocator : &global_allocator)
+
+
+/*
+ * Make allocator, copied, the one used by every thread without an allocator of
+ * its own. NULL restores malloc. Memory allocated before has to be freed before
+ * the allocator changes, so this is meant to be called once at start up
+ */
+void json_set_allocator(const json_allocator *allocator)
+{
+    global_allocator = allocator ? *allocator : libc_allocator;
+}
+
+/*
+ * Make allocator, which has to stay valid while in use, the one of the calling
+ * thread and return the previous one. NULL goes back to the global allocator.
+ * Values have to be changed and destroyed with the allocator they were built
+ * with in effect
+ */
+const json_allocator *json_use_allocator(const json_allocator *allocator)
+{
+    const json_allocator *previous = thread_allocator;
+
+    thread_allocator = allocator;
+    return previous;
+}
+
+/*
+ * Free memory the library handed out, such as the strings of json2string
+ */
+void json_free(void *ptr)
+{
+    if (ptr)
+    {
+        ALLOCATOR()->free_fn(ptr, ALLOCATOR()->ctx);
+    }
+}
+
+
+void *json_malloc(size_t size)
+{
+    return ALLOCATOR()->malloc_fn(size, ALLOCATOR()->ctx);
+}
+
+void *json_calloc(size_t n, size_t size)
+{
+    void *ptr = NULL;
+
+    // a wrapped product would hand out a short block
+    if (size && n > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+
+    ptr = json_malloc(n * size);
+
+    if (ptr)
+    {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+void *json_realloc(void *ptr, size_t size)
+{
+    return ALLOCATOR()->realloc_fn(ptr, size, ALLOCATOR()->ctx);
+}
+
+char *json_strdup(const char *str)
+{
+    size_t  len = strlen(str) + 1;
+    char   *copy = (char *) json_malloc(len);
+
+    if (copy)
+    {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+/*
+ * Return the allocator of the calling thread, NULL if it uses the global one,
+ * for worker threads to take over
+ */
+const json_allocator *json_thread_allocator(void)
+{
+    return thread_allocator;
+}
+
+/*
+ * Return true if memory comes from malloc, whose blocks can be inspected
+ */
+bool json_allocator_is_libc(void)
+{
+    return ALLOCATOR()->malloc_fn == libc_malloc;
+}
+
+
+static void *libc_malloc(size_t size, void *ctx)
+{
+    (void) ctx;
+    return malloc(size);
+}
+
+static void *libc_realloc(void *ptr, size_t size, void *ctx)
+{
+    (void) ctx;
+    return realloc(ptr, size);
+}
+
+static void libc_free(void *ptr, void *ctx)
+{
+    (void) ctx;
+    free(ptr);
+}
@@ -0,0 +1,18 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "json.h"
+
+/* allocation through the allocator in effect, see json_set_allocator */
+void *json_malloc(size_t size);
+void *json_calloc(size_t n, size_t size);
+void *json_realloc(void *ptr, size_t size);
+char *json_strdup(const char *str);
+
+const json_allocator *json_thread_allocator(void);
+bool  json_allocator_is_libc(void);
+
+#endif // ALLOC_H
@@ -0,0 +1,80 @@
+/*
+ * Measure the parsing throughput of one large array for an increasing number
+ * of threads
+ *
+ * usage: array_bench [size_mb] [max_threads]
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../json.h"
+
+static char *make_array(size_t size, size_t *len)
+{
+    char   *buf = (char *) malloc(size + 512);
+    size_t  written = 0;
+    int     i = 0;
+
+    buf[written++] = '[';
+    while (written < size)
+    {
+        written += sprintf(buf + written,
+            "%s{\"id\":%d,\"name\":\"record %d\",\"region\":{\"id\":\"SSF\","
+            "\"value\":\"Sub-Saharan Africa \"},\"tags\":[\"a\",\"b\",\"c\"],"
+            "\"longitude\":%d.%04d,\"active\":%s}\n",
+            i ? "," : "", i, i, i % 180, i % 10000, (i % 2) ? "true" : "false");
+        i++;
+    }
+    buf[written++] = ']';
+
+    *len = written;
+    return buf;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *buf, size_t len, int threads)
+{
+    json_parallel_options  options = { threads, 0, 0, false };
+    json_output           *output = NULL;
+    double                 start = now();
+
+    output = json_parse_parallel(buf, len, &options);
+    if (output->error)
+    {
+        printf("%s at %zu\n", json_error2string(output->error), output->buffer_idx);
+    }
+
+    json_output_destroy(output);
+    return now() - start;
+}
+
+int main(int argc, char const *argv[])
+{
+    size_t  size_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+    long    max_threads = argc > 2 ? strtol(argv[2], NULL, 10)
+                                   : sysconf(_SC_NPROCESSORS_ONLN);
+    size_t  len = 0;
+    char   *buf = make_array(size_mb << 20, &len);
+    double  mb = len / (double) (1 << 20);
+    double  secs;
+    long    threads;
+
+    for (threads = 1; threads <= max_threads; threads *= 2)
+    {
+        secs = run(buf, len, threads);
+        printf("%3ld threads:   %8.1f MB/s\n", threads, mb / secs);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Measure NDJSON parsing throughput for an increasing number of threads
+ *
+ * usage: ndjson_bench [size_mb] [max_threads]
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../json.h"
+
+static char *make_ndjson(size_t size, size_t *len)
+{
+    char   *buf = (char *) malloc(size + 512);
+    size_t  written = 0;
+    int     i = 0;
+
+    while (written < size)
+    {
+        written += sprintf(buf + written,
+            "{\"id\":%d,\"name\":\"record %d\",\"region\":{\"id\":\"SSF\","
+            "\"value\":\"Sub-Saharan Africa \"},\"tags\":[\"a\",\"b\",\"c\"],"
+            "\"longitude\":%d.%04d,\"active\":%s}\n",
+            i, i, i % 180, i % 10000, (i % 2) ? "true" : "false");
+        i++;
+    }
+
+    *len = written;
+    return buf;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *buf, size_t len, int threads)
+{
+    json_parallel_options  options = { threads, 0, 0, false };
+    json_ndjson           *nd = NULL;
+    json_record            record;
+    double                 start = now();
+
+    nd = threads ? json_ndjson_open_parallel(buf, len, &options)
+                 : json_ndjson_open(buf, len);
+
+    while (json_ndjson_next(nd, &record))
+    {
+        if (record.error)
+        {
+            printf("line %zu: %s\n", record.line, json_error2string(record.error));
+        }
+        json_destroy(record.root);
+    }
+
+    json_ndjson_close(nd);
+    return now() - start;
+}
+
+int main(int argc, char const *argv[])
+{
+    size_t  size_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+    long    max_threads = argc > 2 ? strtol(argv[2], NULL, 10)
+                                   : sysconf(_SC_NPROCESSORS_ONLN);
+    size_t  len = 0;
+    char   *buf = make_ndjson(size_mb << 20, &len);
+    double  mb = len / (double) (1 << 20);
+    double  secs;
+    long    threads;
+
+    secs = run(buf, len, 0);
+    printf("serial reader: %8.1f MB/s\n", mb / secs);
+
+    for (threads = 1; threads <= max_threads; threads *= 2)
+    {
+        secs = run(buf, len, threads);
+        printf("%3ld threads:   %8.1f MB/s\n", threads, mb / secs);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Measure parsing throughput and peak RSS of our own json2string output with
+ * and without JSON_PARSE_TRUSTED and JSON_PARSE_EXACT_SIZE. The document is
+ * built and each setting runs in a process of its own, a child starts from the
+ * peak of its parent
+ *
+ * usage: trusted_bench [records] [rounds]
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../json.h"
+
+static char *make_document(int records)
+{
+    json *root = JSON_OBJECT_CREATE();
+    json *group = NULL;
+    char *str = NULL;
+    char  buf[128];
+    int   i;
+
+    // records are grouped, objects with many keys are slow to build
+    for (i = 0; i < records; i++)
+    {
+        json *record = JSON_OBJECT_CREATE();
+        json *tags = JSON_ARRAY_CREATE();
+
+        if (i % 100 == 0)
+        {
+            group = JSON_OBJECT_CREATE();
+            snprintf(buf, sizeof(buf), "group %d", i / 100);
+            json_object_put_complex_value(root, buf, group);
+        }
+
+        snprintf(buf, sizeof(buf), "record %d, Sub-Saharan Africa (excluding high income)", i);
+        json_object_put_number(record, "id", i);
+        json_object_put_string(record, "name", buf);
+        json_object_put_string(record, "capital", "S\xc3\xa3o Tom\xc3\xa9");
+        json_object_put_boolean(record, "active", i % 2);
+        json_array_append_string(tags, "alpha");
+        json_array_append_string(tags, "beta");
+        json_object_put_complex_value(record, "tags", tags);
+        json_object_put_complex_value(group, buf, record);
+    }
+
+    str = json2string(root, 0);
+    json_destroy(root);
+    return str;
+}
+
+/*
+ * Build the document in a child and read it through a pipe, so that building
+ * it does not count towards the peaks
+ */
+static char *read_document(int records, size_t *len)
+{
+    size_t   alloced = 1 << 20;
+    char    *buf = (char *) malloc(alloced);
+    ssize_t  n;
+    int      fds[2];
+    pid_t    pid;
+
+    *len = 0;
+    if (!buf || pipe(fds) < 0 || (pid = fork()) < 0)
+    {
+        perror("read_document");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        char   *str = make_document(records);
+        size_t  str_len = strlen(str);
+        size_t  off = 0;
+
+        close(fds[0]);
+        while (off < str_len && (n = write(fds[1], str + off, str_len - off)) > 0)
+            off += n;
+        _exit(off == str_len ? 0 : 1);
+    }
+
+    close(fds[1]);
+    while ((n = read(fds[0], buf + *len, alloced - *len - 1)) > 0)
+    {
+        *len += n;
+        if (*len + 1 == alloced && !(buf = (char *) realloc(buf, alloced *= 2)))
+        {
+            perror("read_document");
+            exit(1);
+        }
+    }
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    buf[*len] = '\0';
+    return buf;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *buf, size_t len, int flags, int rounds)
+{
+    json_parse_options  options = { flags, NULL, 0 };
+    double              start = now();
+    int                 i;
+
+    for (i = 0; i < rounds; i++)
+    {
+        json_output *output = json_parse_ex(buf, len, &options);
+        if (output->error)
+        {
+            printf("%s at %zu\n", json_error2string(output->error), output->buffer_idx);
+        }
+        json_output_destroy(output);
+    }
+
+    return now() - start;
+}
+
+static void measure(const char *name, const char *buf, size_t len, int flags, int rounds)
+{
+    double        mb = len / (double) (1 << 20) * rounds;
+    struct rusage usage;
+    pid_t         pid;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+    {
+        perror("fork");
+        return;
+    }
+    if (pid == 0)
+    {
+        printf("%s %8.1f MB/s", name, mb / run(buf, len, flags, rounds));
+        fflush(stdout);
+        _exit(0);
+    }
+
+    if (wait4(pid, NULL, 0, &usage) < 0)
+    {
+        perror("wait4");
+        return;
+    }
+    printf(", peak RSS %8.1f MB\n", usage.ru_maxrss / 1024.0);
+}
+
+int main(int argc, char const *argv[])
+{
+    int     records = argc > 1 ? atoi(argv[1]) : 100000;
+    int     rounds = argc > 2 ? atoi(argv[2]) : 5;
+    size_t  len;
+    char   *buf = read_document(records, &len);
+
+    printf("input:   %8.1f MB\n", len / (double) (1 << 20));
+    measure("checked:", buf, len, 0, rounds);
+    measure("trusted:", buf, len, JSON_PARSE_TRUSTED, rounds);
+    measure("exact:  ", buf, len, JSON_PARSE_EXACT_SIZE, rounds);
+
+    free(buf);
+    return 0;
+}
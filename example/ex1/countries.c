@@ -9,30 +9,6 @@
 
 #include "../../json.h"
 
-static char *read_file(const char *file_name)
-{
-    int     written = 0;
-    int     buf_sz = 100000; // the file is 97.1 KB
-    char    *country_data = (char *) malloc(buf_sz * sizeof(char));
-
-    FILE    *fp    = fopen(file_name, "r");
-    char    *line  = NULL;
-    size_t  n      = 0;
-    ssize_t read;
-
-    // read the file data into memory (wish we had a file iterator in iterator.c)
-    country_data[0] = '\0';
-    while ((read = getline(&line, &n, fp)) != -1)
-    {
-        strcat(country_data + written, line);
-        written += read;
-    }
-
-    free(line);
-    fclose(fp);
-    return country_data;
-}
-
 static int country_compare(const void *c1, const void *c2)
 {
     json *cp1 = *(json **) c1;
@@ -118,13 +94,10 @@ exit:
 int main(int argc, char const *argv[])
 {
     const char  *file_name = "./countries.json";
-    char        *country_data = NULL;
     json_output *output = NULL;
     json        *root = NULL;
     
-    country_data = read_file(file_name);
-    output = json_parse(country_data);
-    free(country_data);
+    output = json_parse_file(file_name, 0);
 
     root = output->root;
 
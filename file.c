@@ -0,0 +1,302 @@
+/*
+ * Parsing JSON files
+ *
+ * Files are either mapped into memory and parsed in place, so the only memory
+ * used besides the page cache is the tree itself, or streamed through a buffer
+ * of fixed size and given out one value at a time: the elements of a root
+ * array, or else the root value whole.
+ */
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "json.h"
+#include "parser.h"
+#include "iterator.h"
+#include "alloc.h"
+#include "utils.h"
+
+#define STREAM_DEFAULT_BUF_SIZE    (1 << 16)
+#define STREAM_MIN_BUF_SIZE        (2 * BYTES_PER_UNICODE_CHAR)
+
+typedef enum stream_state
+{
+    STREAM_START,
+    STREAM_VALUE,    // a root value other than an array, given out whole
+    STREAM_ELEMENTS, // the elements of a top level array
+    STREAM_END,
+} stream_state;
+
+struct json_stream
+{
+    json_parser   parser;
+    json_source   source;
+    stream_state  state;
+    size_t        error_loc;
+};
+
+static json_stream *stream_open(int fd, FILE *fp, size_t buf_size);
+static bool         stream_fail(json_stream *stream, int error, size_t loc);
+
+
+/*
+ * Parse the file at path. flags is a mask of JSON_FILE_POPULATE, to fault the
+ * whole mapping in up front, and JSON_FILE_SEQUENTIAL, to have the kernel read
+ * ahead aggressively. A file that can't be opened, or mapped, gives
+ * JSON_ERROR_IO and an empty file JSON_ERROR_EMPTY_INPUT. NULL is returned if
+ * not even the output can be allocated
+ */
+json_output *json_parse_file(const char *path, int flags)
+{
+    LOGFUNC();
+    json_parser  parser;
+    json_output *output = (json_output *) json_calloc(1, sizeof(json_output));
+    struct stat  st;
+    void        *map = MAP_FAILED;
+    int          map_flags = MAP_PRIVATE;
+    int          fd = -1;
+
+    if (!output)
+    {
+        return NULL;
+    }
+
+    if (!path || (fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    {
+        output->error = JSON_ERROR_IO;
+        goto exit;
+    }
+
+    if (st.st_size == 0)
+    {
+        output->error = JSON_ERROR_EMPTY_INPUT;
+        goto exit;
+    }
+
+#ifdef MAP_POPULATE
+    if (flags & JSON_FILE_POPULATE)
+        map_flags |= MAP_POPULATE;
+#endif
+
+    map = mmap(NULL, st.st_size, PROT_READ, map_flags, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        output->error = JSON_ERROR_IO;
+        goto exit;
+    }
+
+    if (flags & JSON_FILE_SEQUENTIAL)
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifndef MAP_POPULATE
+    if (flags & JSON_FILE_POPULATE)
+        madvise(map, st.st_size, MADV_WILLNEED);
+#endif
+
+    json_parser_init_buffer(&parser, (const char *) map, st.st_size);
+    output->root = json_parser_run(&parser);
+    output->error = parser.error;
+    output->buffer_idx = parser.buffer_idx;
+
+exit:
+    if (map != MAP_FAILED)
+        munmap(map, st.st_size);
+    if (fd >= 0)
+        close(fd);
+    return output;
+}
+
+
+/*
+ * Stream the JSON read from fd through a buffer of buf_size bytes (0 picks a
+ * default). Only a root array is streamed: json_stream_next gives out its
+ * elements one by one, so memory stays in the order of the largest element.
+ * Any other root value is given out whole, taking as much memory as parsing
+ * the whole input would. As with json_parse only whitespace may follow the
+ * root value, anything else fails with JSON_ERROR_INVALID_JSON. fd is not
+ * closed. NULL is returned if memory ran out
+ */
+json_stream *json_parse_fd(int fd, size_t buf_size)
+{
+    return stream_open(fd, NULL, buf_size);
+}
+
+/*
+ * Like json_parse_fd for a stdio stream. fp is not closed
+ */
+json_stream *json_parse_fp(FILE *fp, size_t buf_size)
+{
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    return stream_open(-1, fp, buf_size);
+}
+
+/*
+ * Parse the next value of stream into value, owned by the caller. Return false
+ * at the end of the input or on an error, which ends the stream, see
+ * json_stream_get_error
+ */
+bool json_stream_next(json_stream *stream, json **value)
+{
+    LOGFUNC();
+    json_parser *parser;
+    int32_t      c;
+    size_t       end;
+
+    if (!stream || !value)
+    {
+        return false;
+    }
+
+    parser = &stream->parser;
+    *value = NULL;
+
+    switch (stream->state)
+    {
+        case STREAM_START:
+            c = json_peek(parser);
+            if (c == '\0')
+            {
+                return stream_fail(stream,
+                    parser->error ? parser->error : JSON_ERROR_EMPTY_INPUT, 0);
+            }
+
+            if (c != '[')
+            {
+                stream->state = STREAM_VALUE;
+                goto PARSE;
+            }
+
+            json_next(parser);
+            parser->depth = 1;
+            stream->state = STREAM_ELEMENTS;
+
+            if (json_peek(parser) == ']')
+            {
+                json_next(parser);
+                break;
+            }
+            if (json_peek(parser) == '\0')
+            {
+                return stream_fail(stream, JSON_ERROR_UNBALANCED_SQUARE_BRACKET,
+                    parser->offset + parser->buffer_idx);
+            }
+            goto PARSE;
+
+        case STREAM_ELEMENTS:
+            c = json_next(parser);
+            if (c == ',')
+            {
+                goto PARSE;
+            }
+            if (c != ']')
+            {
+                return stream_fail(stream, JSON_ERROR_UNBALANCED_SQUARE_BRACKET,
+                    parser->offset + parser->buffer_idx);
+            }
+            break;
+
+        case STREAM_VALUE:
+            break;
+
+        case STREAM_END:
+            return false;
+    }
+
+    // only whitespace may follow the root value
+    end = parser->offset + parser->buffer_idx;
+    c = json_peek(parser);
+    if (c == '\0' && !parser->error && parser->buffer_idx >= parser->buffer_sz)
+    {
+        stream->state = STREAM_END;
+        return false;
+    }
+    return stream_fail(stream, JSON_ERROR_INVALID_JSON, end);
+
+PARSE:
+    if (!(*value = json_parser_parse_value(parser)))
+    {
+        return stream_fail(stream, JSON_ERROR_INVALID_JSON,
+            parser->offset + parser->buffer_idx);
+    }
+
+    return true;
+}
+
+/*
+ * Return the error that ended stream, JSON_ERROR_NONE if there was none
+ */
+int json_stream_get_error(json_stream *stream)
+{
+    return stream ? stream->parser.error : JSON_ERROR_NONE;
+}
+
+/*
+ * Return the offset in the input of the error that ended stream
+ */
+size_t json_stream_get_error_loc(json_stream *stream)
+{
+    return stream ? stream->error_loc : 0;
+}
+
+/*
+ * Free stream, leaving its file open
+ */
+void json_stream_close(json_stream *stream)
+{
+    if (!stream)
+    {
+        return;
+    }
+
+    json_free(stream->source.buf);
+    json_free(stream);
+}
+
+
+static json_stream *stream_open(int fd, FILE *fp, size_t buf_size)
+{
+    json_stream *stream = (json_stream *) json_calloc(1, sizeof(json_stream));
+
+    if (!stream)
+        return NULL;
+
+    if (buf_size == 0)
+        buf_size = STREAM_DEFAULT_BUF_SIZE;
+    if (buf_size < STREAM_MIN_BUF_SIZE)
+        buf_size = STREAM_MIN_BUF_SIZE;
+
+    stream->source.fd = fd;
+    stream->source.fp = fp;
+    if (!(stream->source.buf = (unsigned char *) json_malloc(buf_size)))
+    {
+        json_free(stream);
+        return NULL;
+    }
+    stream->source.buf_size = buf_size;
+
+    json_parser_init_buffer(&stream->parser, (const char *) stream->source.buf, 0);
+    stream->parser.source = &stream->source;
+    stream->state = STREAM_START;
+    return stream;
+}
+
+/*
+ * End stream with error, unless an error was already set, at loc
+ */
+static bool stream_fail(json_stream *stream, int error, size_t loc)
+{
+    if (!stream->parser.error)
+    {
+        stream->parser.error = error;
+    }
+
+    stream->error_loc = loc;
+    stream->state = STREAM_END;
+    return false;
+}
@@ -1,11 +1,66 @@
 /* ITERATOR */
 
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "parser.h"
 #include "iterator.h"
 
 #define CHAR_IS_WHITESPACE(c)    ((c) == '\t' || (c) == '\n' || \
                                   (c) == '\r' || (c) == ' ')
 
+/* never let the UTF-8 decoder look past the end of the buffer */
+#define BYTES_LEFT(p)            ((p)->buffer_sz - (p)->buffer_idx < BYTES_PER_UNICODE_CHAR \
+                                  ? (p)->buffer_sz - (p)->buffer_idx \
+                                  : BYTES_PER_UNICODE_CHAR)
+
+/* a streamed buffer may end in the middle of a character */
+#define NEEDS_REFILL(p)          ((p)->source && !(p)->source->eof \
+                                  && (p)->buffer_idx + BYTES_PER_UNICODE_CHAR > (p)->buffer_sz)
+
+/*
+ * Drop the consumed part of a streamed buffer and read more input after the
+ * rest. Return false when nothing more could be read
+ */
+static bool refill(json_parser *parser)
+{
+    json_source *source = parser->source;
+    size_t       left = parser->buffer_sz - parser->buffer_idx;
+    size_t       room;
+    ssize_t      read_sz;
+
+    memmove(source->buf, source->buf + parser->buffer_idx, left);
+    parser->offset += parser->buffer_idx;
+    parser->buffer_idx = 0;
+    parser->buffer_sz = left;
+    room = source->buf_size - left;
+
+    if (source->fp)
+    {
+        read_sz = fread(source->buf + left, 1, room, source->fp);
+        if (read_sz == 0 && ferror(source->fp))
+            read_sz = -1;
+    }
+    else
+    {
+        do {
+            read_sz = read(source->fd, source->buf + left, room);
+        } while (read_sz < 0 && errno == EINTR);
+    }
+
+    if (read_sz <= 0)
+    {
+        source->eof = true;
+        if (read_sz < 0 && !parser->error)
+            parser->error = JSON_ERROR_IO;
+        return false;
+    }
+
+    parser->buffer_sz += read_sz;
+    return true;
+}
+
 /*
  * Advance forward until the next unconsumed character is no stace except when
  * parsing strings
@@ -14,13 +69,15 @@ static void skip_space(json_parser *parser)
 {
     if (parser->skip_space)
     {
-        while (parser->buffer_idx < parser->buffer_sz)
-        {
-            uint8_t c = parser->buffer[parser->buffer_idx];
-            if (!CHAR_IS_WHITESPACE(c))
-                return;
-            parser->buffer_idx++;
-        }
+        do {
+            while (parser->buffer_idx < parser->buffer_sz)
+            {
+                uint8_t c = parser->buffer[parser->buffer_idx];
+                if (!CHAR_IS_WHITESPACE(c))
+                    return;
+                parser->buffer_idx++;
+            }
+        } while (parser->source && !parser->source->eof && refill(parser));
     }
 }
 
@@ -36,13 +93,18 @@ int32_t json_peek(json_parser *parser)
     utf8proc_int32_t code_point = 0;
     utf8proc_ssize_t read;
     
+    if (NEEDS_REFILL(parser))
+    {
+        refill(parser);
+    }
+
     if (parser->buffer_idx >= parser->buffer_sz || parser->error)
     {
         return 0;
     }
 
     read = utf8proc_iterate(parser->buffer + parser->buffer_idx,
-        BYTES_PER_UNICODE_CHAR, &code_point);
+        BYTES_LEFT(parser), &code_point);
 
     if (read < 0) 
     {
@@ -54,7 +116,8 @@ int32_t json_peek(json_parser *parser)
 
 
 /*
- * Return the next unconsumed character and advance
+ * Return the next unconsumed character and advance. The end of the buffer reads
+ * as a NUL character that, like a string terminator, is consumed only once.
  */
 int32_t json_next(json_parser *parser)
 {
@@ -63,13 +126,22 @@ int32_t json_next(json_parser *parser)
     utf8proc_int32_t code_point = 0;
     utf8proc_ssize_t read;
 
+    if (NEEDS_REFILL(parser))
+    {
+        refill(parser);
+    }
+
     if (parser->buffer_idx >= parser->buffer_sz || parser->error)
     {
+        if (parser->buffer_idx == parser->buffer_sz && !parser->error)
+        {
+            parser->buffer_idx++;
+        }
         return 0;
     }
 
     read = utf8proc_iterate(parser->buffer + parser->buffer_idx, 
-        BYTES_PER_UNICODE_CHAR, &code_point);
+        BYTES_LEFT(parser), &code_point);
 
     if (read < 0) 
     {
@@ -8,7 +8,14 @@
 #include <assert.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
 #include "json.h"
+#include "alloc.h"
+
+/* bytes taken by one element of array */
+#define SLOT_SIZE(js)       (((js)->flags & JSON_PACKED) ? sizeof(double) : sizeof(json *))
 
 /* static function declarations */
 static bool json_is_equal(json *js, const void *val, json_type type);
@@ -18,15 +25,39 @@ static void string_buf_append(string_buf *buf, const char *fmt, ...);
 static unsigned char *string2escaped_string(const unsigned char *str);
 
 static void pair_destroy(obj_pair *pair);
+static void json_destroy_value(json *js, json **pending);
+static bool json_unref(json *js);
+static json *json_copy_node(json *js);
+static json **json_child_slot(json *js, const char *name, size_t len);
+static bool json_assign(json *js, json_type type, const void *val);
+static int  json_replace(json **slot, json_type type, const void *val);
+static bool json_unfix(json *js);
+static bool json_walk(json **slot, bool (*enter)(json **slot, void *ctx),
+    void (*leave)(json *js, void *ctx), void *ctx);
+static bool compact_trim(json **slot, void *ctx);
+static size_t compact_size(json *js);
+static bool compact_size_node(json **slot, void *size);
+static json *compact_copy(json *js, char **cursor, int flags);
+static bool compact_copy_node(json **slot, void *ctx);
+static bool memory_usage(json **slot, void *usage);
+static bool freeze_node(json **slot, void *ctx);
+static void freeze_leave(json *js, void *ctx);
 static int  json_object_generic_get(json *object, const char *key, void *val_ptr, json_type type);
 static bool json_object_has_value(json *object, const void *val, json_type type);
 static int  json_object_generic_put(json *object, const char *key, const void *val, json_type type);
-
-static int  json_array_index_of(json *array, const void *val, json_type type);
-static int  json_array_generic_get(json *array, int idx, void *val_ptr, json_type type);
-static int  json_array_generic_add(json *array, int idx, json_type type, const void *val);
-static void json_array_append(json *array, const void *val, json_type type);
-static void json_array_remove_element(json *array, const void *elem, json_type type);
+static void json_object_drop(json *object, obj_pair *pair);
+static bool json_object_key_is(const char *key, json *value, void *ctx);
+
+static ssize_t json_array_index_of(json *array, const void *val, json_type type);
+static int  json_array_generic_get(json *array, ssize_t idx, void *val_ptr, json_type type);
+static bool json_array_bulk_count(json *array, const void *out, size_t n, size_t *cnt,
+    size_t *written);
+static int  json_array_generic_add(json *array, ssize_t idx, json_type type, const void *val);
+static int  json_array_append(json *array, const void *val, json_type type);
+static bool json_array_grow(json *array, size_t cnt);
+static int  json_array_insert_values(json *array, ssize_t idx, const void *vals, size_t n,
+    json_type type);
+static int  json_array_remove_element(json *array, const void *elem, json_type type);
 static bool json_array_has_value(json *array, const void *val, json_type type);
 
 /* ========== GENERIC METHODS ========== */
@@ -104,18 +135,26 @@ static void json_shallow_copy(json *js, const void *val_ptr, json_type type)
 }
 
 /*
- * Create a json object given the type of the object
+ * Create a json object given the type of the object, NULL if memory ran out
  */
 json *json_create(json_type type)
 {
     assert(type > JSON_TYPE_NONE || type < JSON_TYPE_END);
 
-    json *js = (json *) calloc(1, sizeof(json));
+    // scalars are allocated without cnt and alloced
+    json *js = (json *) json_calloc(1, JSON_NODE_SIZE(type));
+
+    if (!js)
+        return NULL;
     js->type = type;
 
     if (type == JSON_TYPE_STRING)
     {
-        js->string_val = (unsigned char *) calloc(1, sizeof(unsigned char));
+        if (!(js->string_val = (unsigned char *) json_calloc(1, sizeof(unsigned char))))
+        {
+            json_free(js);
+            return NULL;
+        }
         js->alloced = 1;
     }
 
@@ -130,7 +169,9 @@ json *json_create(json_type type)
 json *json_full_create(json_type type, const void *val)
 {
     json *js = NULL;
-    js = json_create(type);
+
+    if (!(js = json_create(type)))
+        return NULL;
 
     switch (type)
     {
@@ -141,8 +182,12 @@ json *json_full_create(json_type type, const void *val)
             js->bool_val = *(bool *) val;
             break;
         case JSON_TYPE_STRING:
-            free(js->string_val); // TODO: hacky
-            js->string_val = (unsigned char *) strdup((char *) val);
+            json_free(js->string_val); // TODO: hacky
+            if (!(js->string_val = (unsigned char *) json_strdup((char *) val)))
+            {
+                json_free(js);
+                return NULL;
+            }
             js->cnt = strlen((char *) js->string_val);
             js->alloced = js->cnt + 1;
             break;
@@ -154,10 +199,96 @@ json *json_full_create(json_type type, const void *val)
 
 /*****************************************************************************/
 
+/*
+ * Give js the value val of type in place, when its memory can hold it: a
+ * number, boolean or null becomes a number or boolean and a string takes
+ * another string, in its own buffer if it fits. Return false otherwise, with
+ * js left as it was
+ */
+static bool json_assign(json *js, json_type type, const void *val)
+{
+    if (JSON_NODE_SIZE(js->type) != JSON_NODE_SIZE(type))
+        return false;
+
+    switch (type)
+    {
+        case JSON_TYPE_NUMBER:
+            js->num_val = *(double *) val;
+            break;
+        case JSON_TYPE_BOOLEAN:
+            js->bool_val = *(bool *) val;
+            break;
+        case JSON_TYPE_STRING:
+        {
+            size_t         len;
+            unsigned char *buf;
+
+            if (js->type != JSON_TYPE_STRING)
+                return false;
+
+            len = strlen((char *) val);
+            if (len + 1 <= js->alloced)
+            {
+                // val may be a part of the string itself
+                memmove(js->string_val, val, len + 1);
+            }
+            else
+            {
+                if (!(buf = (unsigned char *) json_malloc(len + 1)))
+                    return false;
+                memcpy(buf, val, len + 1);
+                if (!(js->flags & JSON_FIXED_BUF))
+                    json_free(js->string_val);
+                js->string_val = buf;
+                js->alloced = len + 1;
+                js->flags &= ~JSON_FIXED_BUF;
+            }
+            js->cnt = len;
+            break;
+        }
+        default:
+            return false;
+    }
+
+    js->type = type;
+    return true;
+}
+
+/*
+ * Put the value val of type in *slot, reusing the value there when it can be.
+ * Values of other types than strings, numbers and booleans are val itself
+ */
+static int json_replace(json **slot, json_type type, const void *val)
+{
+    json *js = NULL;
+
+    if (!IS_PRIMITIVE_TYPE(type))
+    {
+        if (*slot != val)
+        {
+            json_destroy(*slot);
+            *slot = (json *) val;
+        }
+        return API_SUCCESS;
+    }
+
+    if (!JSON_IS_READONLY(*slot) && json_assign(*slot, type, val))
+        return API_SUCCESS;
+
+    if (!(js = json_full_create(type, val)))
+        return API_FAILURE;
+
+    json_destroy(*slot);
+    *slot = js;
+    return API_SUCCESS;
+}
+
+/*****************************************************************************/
+
 /*
  * Return the size of json "object"
  */
-int json_get_size(json *js)
+ssize_t json_get_size(json *js)
 {
     if (!js || !JSON_HAS_SIZE(js))
     {
@@ -183,58 +314,627 @@ bool json_is_empty(json *js)
  */
 static void pair_destroy(obj_pair *pair)
 {
-    free(pair->key);
+    json_free(pair->key);
     json_destroy(pair->value);
-    free(pair);
+    json_free(pair);
 }
 
+/* containers whose values are still to be destroyed are linked through alloced */
+#define DESTROY_NEXT(js)    ((json *) (uintptr_t) (js)->alloced)
+
 /*
- * Destoy json object based on type
+ * Destroy js or, if it is a container, add it to pending for json_destroy to
+ * take apart, so that deep trees don't take deep recursion
  */
-void json_destroy(json *js)
+static void json_destroy_value(json *js, json **pending)
 {
-    if (!js)
+    // a shared value only loses a reference
+    if (!js || !json_unref(js))
         return;
 
     switch (js->type)
     {
         case JSON_TYPE_OBJECT:
+        case JSON_TYPE_ARRAY:
+            js->alloced = (size_t) (uintptr_t) *pending;
+            *pending = js;
+            return;
+        case JSON_TYPE_STRING:
+            if (!(js->flags & JSON_FIXED_BUF))
+                json_free(js->string_val);
+            break;
+        default:
+            break;
+    }
+
+    // the root of a compacted tree is its block
+    if (!(js->flags & JSON_FIXED_NODE))
+        json_free(js);
+}
+
+/*
+ * Destoy json object based on type. A value shared with json_share is only
+ * destroyed with its last reference
+ */
+void json_destroy(json *js)
+{
+    json   *root = NULL;
+    json   *pending = NULL;
+    size_t  i;
+
+    json_destroy_value(js, &pending);
+    root = pending;
+
+    while ((js = pending))
+    {
+        pending = DESTROY_NEXT(js);
+
+        if (JSON_IS_OBJECT(js))
         {
-            int i;
             for (i = 0; i < js->cnt; i++)
             {
-                pair_destroy(js->members[i]);
+                obj_pair *pair = js->members[i];
+
+                json_destroy_value(pair->value, &pending);
+                // pairs moved by json_compact go with their root's block
+                if (!(js->flags & JSON_FIXED_BUF))
+                {
+                    json_free(pair->key);
+                    json_free(pair);
+                }
             }
-            free(js->members);
-            free(js);
-            break;
         }
+        else if (!(js->flags & JSON_PACKED))
+        {
+            for (i = 0; i < js->cnt; i++)
+                json_destroy_value(js->elements[i], &pending);
+        }
+
+        // the members, elements or numbers
+        if (!(js->flags & JSON_FIXED_BUF))
+            json_free(js->elements);
+        if (js != root && !(js->flags & JSON_FIXED_NODE))
+            json_free(js);
+    }
+
+    // the root of a compacted tree is the block of its values, freed last
+    if (root && !(root->flags & JSON_FIXED_NODE))
+        json_free(root);
+}
+
+/* a container json_walk is in and the index of its next value */
+typedef struct walk_frame
+{
+    json   *js;
+    size_t  idx;
+} walk_frame;
+
+#define WALK_LOCAL_FRAMES   32
+
+/* true if js holds values for json_walk to go into */
+#define WALK_HAS_VALUES(js) \
+    ((JSON_IS_OBJECT(js) || (JSON_IS_ARRAY(js) && !((js)->flags & JSON_PACKED))) && (js)->cnt)
+
+/*
+ * Call enter on *slot and, depth first, on the slots of the values in it, and
+ * leave, if set, on each container once its values are done. enter may put
+ * another value in the slot and returns false to skip the values in it. The
+ * containers on the way are kept on a stack of their own rather than the call
+ * stack, so that deep trees take no deep recursion. Return false if memory
+ * for that stack ran out, leaving the walk half done
+ */
+static bool json_walk(json **slot, bool (*enter)(json **slot, void *ctx),
+    void (*leave)(json *js, void *ctx), void *ctx)
+{
+    walk_frame  local[WALK_LOCAL_FRAMES];
+    walk_frame *frames = local;
+    walk_frame *grown = NULL;
+    size_t      num_frames = WALK_LOCAL_FRAMES;
+    size_t      depth = 0;
+
+    while (slot || depth)
+    {
+        walk_frame *frame = NULL;
+
+        if (slot)
+        {
+            json *js = enter(slot, ctx) ? *slot : NULL;
+
+            if (WALK_HAS_VALUES(js))
+            {
+                if (depth == num_frames)
+                {
+                    grown = (walk_frame *) json_realloc(frames == local ? NULL : frames,
+                        2 * num_frames * sizeof(walk_frame));
+                    if (!grown)
+                    {
+                        if (frames != local)
+                            json_free(frames);
+                        return false;
+                    }
+                    if (frames == local)
+                        memcpy(grown, local, sizeof(local));
+                    frames = grown;
+                    num_frames *= 2;
+                }
+                frames[depth].js = js;
+                frames[depth++].idx = 0;
+            }
+            slot = NULL;
+            continue;
+        }
+
+        frame = &frames[depth - 1];
+        if (frame->idx == frame->js->cnt)
+        {
+            if (leave)
+                leave(frame->js, ctx);
+            depth--;
+        }
+        else if (JSON_IS_OBJECT(frame->js))
+        {
+            slot = &frame->js->members[frame->idx++]->value;
+        }
+        else
+        {
+            slot = &frame->js->elements[frame->idx++];
+        }
+    }
+
+    if (frames != local)
+        json_free(frames);
+    return true;
+}
+
+/*
+ * Trim the buffers of js and of the values in it, but for shared ones, to their
+ * exact size and return js. With JSON_COMPACT_CONTIGUOUS the tree is moved instead into one block,
+ * laid out depth first, js is destroyed and the new root returned, so js has to
+ * be a root and not a value within another tree. The values of a moved tree can
+ * still be changed but none of them may outlive the root. If memory runs out
+ * NULL is returned and js is left in place, its buffers maybe not all trimmed
+ */
+json *json_compact(json *js, int flags)
+{
+    json *copy = NULL;
+
+    if (!js)
+        return NULL;
+
+    if (!(flags & JSON_COMPACT_CONTIGUOUS))
+        return json_walk(&js, compact_trim, NULL, NULL) ? js : NULL;
+
+    if (!(copy = json_clone(js)))
+        return NULL;
+    json_destroy(js);
+    return copy;
+}
+
+/*
+ * Return a deep copy of js, laid out like json_compact lays out a tree in one
+ * block, NULL if memory ran out. The copy is destroyed with json_destroy
+ */
+json *json_clone(json *js)
+{
+    char   *block = NULL;
+    char   *cursor = NULL;
+    json   *copy = NULL;
+    size_t  size = js ? compact_size(js) : 0;
+
+    if (!size || !(block = cursor = (char *) json_malloc(size)))
+        return NULL;
+
+    if (!(copy = compact_copy(js, &cursor, 0)))
+        json_free(block);
+    return copy;
+}
+
+/*
+ * Return the bytes json_clone_into needs to copy js, 0 if memory ran out
+ */
+size_t json_clone_size(json *js)
+{
+    return js ? compact_size(js) : 0;
+}
+
+/*
+ * Copy js into the size bytes of buf, which has to be aligned like malloc
+ * memory, and return the copy, NULL if it does not fit. buf stays the caller's:
+ * json_destroy on the copy frees only what was allocated by changing it, and buf
+ * may be reused or freed once that is done
+ */
+json *json_clone_into(json *js, void *buf, size_t size)
+{
+    char   *cursor = (char *) buf;
+    size_t  needed = 0;
+
+    if (!js || !buf
+        || (uintptr_t) buf % _Alignof(json)
+        || !(needed = compact_size(js)) || size < needed)
+    {
+        return NULL;
+    }
+
+    return compact_copy(js, &cursor, JSON_FIXED_NODE);
+}
+
+/*
+ * Add up the memory taken by js and the values in it into usage. Return
+ * API_FAILURE if memory ran out on the way
+ */
+int json_memory_usage(json *js, json_memory *usage)
+{
+    if (!js || !usage)
+    {
+        return API_FAILURE;
+    }
+
+    memset(usage, 0, sizeof(json_memory));
+    if (!json_walk(&js, memory_usage, NULL, usage))
+        return API_FAILURE;
+    usage->total = usage->nodes + usage->keys + usage->strings + usage->containers + usage->slack;
+    return API_SUCCESS;
+}
+
+/*
+ * Add the memory taken by *slot, but for the values in it, to usage
+ */
+static bool memory_usage(json **slot, void *ctx)
+{
+    json        *js = *slot;
+    json_memory *usage = (json_memory *) ctx;
+    size_t       i;
 
+    usage->nodes += JSON_NODE_SIZE(js->type);
+
+    switch (js->type)
+    {
+        case JSON_TYPE_OBJECT:
+            usage->nodes += sizeof(obj_pair) * js->cnt;
+            usage->containers += sizeof(obj_pair *) * js->cnt;
+            usage->slack += sizeof(obj_pair *) * (js->alloced - js->cnt);
+            for (i = 0; i < js->cnt; i++)
+                usage->keys += strlen((char *) js->members[i]->key) + 1;
+            break;
         case JSON_TYPE_ARRAY:
+            if (js->flags & JSON_PACKED)
+            {
+                usage->containers += sizeof(double) * js->cnt;
+                usage->slack += sizeof(double) * (js->alloced - js->cnt);
+                break;
+            }
+            usage->containers += sizeof(json *) * js->cnt;
+            usage->slack += sizeof(json *) * (js->alloced - js->cnt);
+            break;
+        case JSON_TYPE_STRING:
+            usage->strings += js->cnt + 1;
+            usage->slack += js->alloced - (js->cnt + 1);
+            break;
+        default:
+            break;
+    }
+
+    return true;
+}
+
+/*
+ * Give a value moved by json_compact buffers of its own, before they change.
+ * Return false if memory ran out, leaving js as it was
+ */
+static bool json_unfix(json *js)
+{
+    size_t i;
+
+    if (!(js->flags & JSON_FIXED_BUF))
+        return true;
+
+    switch (js->type)
+    {
+        case JSON_TYPE_OBJECT:
         {
-            int i;
+            obj_pair **members = NULL;
+
+            if (js->cnt && !(members = (obj_pair **) json_calloc(js->cnt, sizeof(obj_pair *))))
+                return false;
             for (i = 0; i < js->cnt; i++)
-                json_destroy(js->elements[i]);
-            free(js->elements);
-            free(js);
+            {
+                if (!(members[i] = (obj_pair *) json_malloc(sizeof(obj_pair)))
+                    || !(members[i]->key = (unsigned char *) json_strdup((char *) js->members[i]->key)))
+                {
+                    // i + 1 pairs were taken, the last maybe without a key
+                    for (i++; i > 0; i--)
+                    {
+                        if (members[i - 1])
+                            json_free(members[i - 1]->key);
+                        json_free(members[i - 1]);
+                    }
+                    json_free(members);
+                    return false;
+                }
+                members[i]->value = js->members[i]->value;
+            }
+            js->members = members;
+            js->alloced = js->cnt;
             break;
         }
+        case JSON_TYPE_ARRAY:
+        {
+            json   **elements = NULL;
+            size_t   size = js->cnt * SLOT_SIZE(js);
+
+            if (js->cnt && !(elements = (json **) json_malloc(size)))
+                return false;
+            if (js->cnt)
+                memcpy(elements, js->elements, size);
+            js->elements = elements;
+            js->alloced = js->cnt;
+            break;
+        }
+        case JSON_TYPE_STRING:
+        {
+            unsigned char *string_val = (unsigned char *) json_strdup((char *) js->string_val);
+
+            if (!string_val)
+                return false;
+            js->string_val = string_val;
+            js->alloced = js->cnt + 1;
+            break;
+        }
+        default:
+            break;
+    }
+
+    js->flags &= ~JSON_FIXED_BUF;
+    return true;
+}
 
+/*
+ * Give a packed array, see JSON_PARSE_PACK_NUMBERS, a value for each of its
+ * numbers, so that json_array_get and json_array_get_elements can hand them
+ * out. Done by the functions putting a value that is not a number in it, the
+ * getters never do it. Return API_FAILURE if array is shared, frozen or memory
+ * ran out, leaving it packed
+ */
+int json_array_unpack(json *array)
+{
+    json  **elements = NULL;
+    size_t  i;
+
+    if (!JSON_IS_ARRAY(array))
+        return API_FAILURE;
+
+    if (!(array->flags & JSON_PACKED))
+        return API_SUCCESS;
+
+    // readers of a shared or frozen array may be reading the numbers
+    if (JSON_IS_READONLY(array))
+        return API_FAILURE;
+
+    if (array->cnt && !(elements = (json **) json_malloc(sizeof(json *) * array->cnt)))
+        return API_FAILURE;
+
+    for (i = 0; i < array->cnt; i++)
+    {
+        if (!(elements[i] = json_full_create(JSON_TYPE_NUMBER, &array->numbers[i])))
+        {
+            while (i > 0)
+                json_destroy(elements[--i]);
+            json_free(elements);
+            return API_FAILURE;
+        }
+    }
+
+    if (!(array->flags & JSON_FIXED_BUF))
+        json_free(array->numbers);
+    array->elements = elements;
+    array->alloced = array->cnt;
+    array->flags &= ~(JSON_PACKED | JSON_FIXED_BUF);
+    return API_SUCCESS;
+}
+
+#define COMPACT_ALIGN(n)    (((n) + _Alignof(json) - 1) & ~(_Alignof(json) - 1))
+
+/*
+ * Shrink buf to size bytes, freeing it when empty. buf is kept as it is if it
+ * can't be moved
+ */
+static void *shrink(void *buf, size_t size)
+{
+    void *shrunk = NULL;
+
+    if (size == 0)
+    {
+        json_free(buf);
+        return NULL;
+    }
+    return (shrunk = json_realloc(buf, size)) ? shrunk : buf;
+}
+
+/*
+ * Trim the buffers of *slot, but for the values in it, to their exact size.
+ * Shared and frozen values are left as they are, and the values in them too
+ */
+static bool compact_trim(json **slot, void *ctx)
+{
+    json   *js = *slot;
+    bool    fixed = js->flags & JSON_FIXED_BUF;
+    size_t  i;
+
+    (void) ctx;
+    if (JSON_IS_READONLY(js))
+        return false;
+
+    switch (js->type)
+    {
+        case JSON_TYPE_OBJECT:
+            for (i = 0; !fixed && i < js->cnt; i++)
+            {
+                obj_pair *pair = js->members[i];
+
+                pair->key = (unsigned char *) shrink(pair->key, strlen((char *) pair->key) + 1);
+            }
+            if (!fixed && js->alloced > js->cnt)
+            {
+                js->members = (obj_pair **) shrink(js->members, sizeof(obj_pair *) * js->cnt);
+                js->alloced = js->cnt;
+            }
+            break;
+        case JSON_TYPE_ARRAY:
+            if (!fixed && js->alloced > js->cnt)
+            {
+                js->elements = (json **) shrink(js->elements, SLOT_SIZE(js) * js->cnt);
+                js->alloced = js->cnt;
+            }
+            break;
+        case JSON_TYPE_STRING:
+            if (!fixed && js->alloced > js->cnt + 1)
+            {
+                js->string_val = (unsigned char *) shrink(js->string_val, js->cnt + 1);
+                js->alloced = js->cnt + 1;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return true;
+}
+
+/*
+ * Return the bytes json_compact needs to move js into one block, 0 if memory
+ * ran out
+ */
+static size_t compact_size(json *js)
+{
+    size_t size = 0;
+
+    return json_walk(&js, compact_size_node, NULL, &size) ? size : 0;
+}
+
+/*
+ * Add the bytes *slot and its buffers take in the block, but for the values in
+ * it, to size
+ */
+static bool compact_size_node(json **slot, void *ctx)
+{
+    json   *js = *slot;
+    size_t *size = (size_t *) ctx;
+    size_t  i;
+
+    *size += COMPACT_ALIGN(JSON_NODE_SIZE(js->type));
+
+    switch (js->type)
+    {
+        case JSON_TYPE_OBJECT:
+            *size += COMPACT_ALIGN(sizeof(obj_pair *) * js->cnt);
+            for (i = 0; i < js->cnt; i++)
+            {
+                *size += COMPACT_ALIGN(sizeof(obj_pair))
+                    + COMPACT_ALIGN(strlen((char *) js->members[i]->key) + 1);
+            }
+            break;
+        case JSON_TYPE_ARRAY:
+            *size += COMPACT_ALIGN(SLOT_SIZE(js) * js->cnt);
+            break;
         case JSON_TYPE_STRING:
-            free(js->string_val);
-            free(js);
+            *size += COMPACT_ALIGN(js->cnt + 1);
             break;
         default:
-            free(js);
             break;
     }
+
+    return true;
+}
+
+/* where compact_copy_node puts the next value and the flags it gets */
+typedef struct compact_cursor
+{
+    char *next;
+    int   flags;
+} compact_cursor;
+
+/*
+ * Copy js to *cursor, followed by its buffers and values, moving the cursor
+ * past them. Return NULL if memory ran out
+ */
+static json *compact_copy(json *js, char **cursor, int flags)
+{
+    compact_cursor at = { *cursor, flags };
+
+    if (!json_walk(&js, compact_copy_node, NULL, &at))
+        return NULL;
+
+    *cursor = at.next;
+    return js;
+}
+
+/*
+ * Copy *slot to the cursor, followed by its buffers, and put the copy in the
+ * slot. The slots of the copy still hold the values of *slot, for the walk to
+ * copy next
+ */
+static bool compact_copy_node(json **slot, void *ctx)
+{
+    compact_cursor *at = (compact_cursor *) ctx;
+    json           *js = *slot;
+    json           *copy = (json *) at->next;
+    size_t          i;
+
+    at->next += COMPACT_ALIGN(JSON_NODE_SIZE(js->type));
+    // all but refs, which other references to js may be changing
+    copy->type = js->type;
+    copy->flags = at->flags | (js->flags & JSON_PACKED);
+    copy->refs = 0;
+    memcpy(&copy->num_val, &js->num_val, JSON_NODE_SIZE(js->type) - offsetof(json, num_val));
+    // the values in it go with the root's block
+    at->flags = JSON_FIXED_NODE;
+
+    switch (js->type)
+    {
+        case JSON_TYPE_OBJECT:
+            copy->members = js->cnt ? (obj_pair **) at->next : NULL;
+            at->next += COMPACT_ALIGN(sizeof(obj_pair *) * js->cnt);
+            for (i = 0; i < js->cnt; i++)
+            {
+                obj_pair *pair = (obj_pair *) at->next;
+                size_t    key_len = strlen((char *) js->members[i]->key) + 1;
+
+                at->next += COMPACT_ALIGN(sizeof(obj_pair));
+                pair->key = (unsigned char *) memcpy(at->next, js->members[i]->key, key_len);
+                at->next += COMPACT_ALIGN(key_len);
+                pair->value = js->members[i]->value;
+                copy->members[i] = pair;
+            }
+            copy->alloced = js->cnt;
+            copy->flags |= JSON_FIXED_BUF;
+            break;
+        case JSON_TYPE_ARRAY:
+            // the numbers of a packed array, or the elements still to be copied
+            copy->elements = js->cnt
+                ? (json **) memcpy(at->next, js->elements, SLOT_SIZE(js) * js->cnt) : NULL;
+            at->next += COMPACT_ALIGN(SLOT_SIZE(js) * js->cnt);
+            copy->alloced = js->cnt;
+            copy->flags |= JSON_FIXED_BUF;
+            break;
+        case JSON_TYPE_STRING:
+            copy->string_val = (unsigned char *) memcpy(at->next, js->string_val, js->cnt + 1);
+            at->next += COMPACT_ALIGN(js->cnt + 1);
+            copy->alloced = js->cnt + 1;
+            copy->flags |= JSON_FIXED_BUF;
+            break;
+        default:
+            break;
+    }
+
+    *slot = copy;
+    return true;
 }
 
 /*****************************************************************************/
 
 static unsigned char *string2escaped_string(const unsigned char *str)
 {
-    int            str_len = strlen((char *)str);
+    size_t         str_len = 0;
     unsigned char *escaped_str = NULL;
     unsigned char *e_str = NULL;
 
@@ -243,7 +943,11 @@ static unsigned char *string2escaped_string(const unsigned char *str)
         return NULL;
     }
 
-    escaped_str = (unsigned char *) malloc(sizeof(unsigned char) * (2 * str_len + 1));
+    str_len = strlen((char *) str);
+    if (!(escaped_str = (unsigned char *) json_malloc(sizeof(unsigned char) * (2 * str_len + 1))))
+    {
+        return NULL;
+    }
     e_str = escaped_str;
 
     for ( ; *str; str++)
@@ -293,6 +997,12 @@ static void string_buf_append(string_buf *buf, const char *fmt, ...)
     int     size = 0;
     va_list ap;
 
+    // a buffer that could not grow is dropped, see json2string
+    if (!buf->string)
+    {
+        return;
+    }
+
     /* Determine required size */
     va_start(ap, fmt);
     size = vsnprintf(NULL, size, fmt, ap);
@@ -304,10 +1014,18 @@ static void string_buf_append(string_buf *buf, const char *fmt, ...)
     }
 
     // increase buffer if we will leave no space for the null character
-    if (buf->cnt + size > (buf->alloced - 1))
+    if (buf->cnt + size > buf->alloced - 1)
     {
+        char *string = (char *) json_realloc(buf->string, sizeof(char) * (buf->cnt + size + 64));
+
+        if (!string)
+        {
+            json_free(buf->string);
+            buf->string = NULL;
+            return;
+        }
+        buf->string = string;
         buf->alloced = buf->cnt + size + 64; // add 64 more bytes
-        buf->string = (char *) realloc(buf->string, sizeof(char) * buf->alloced);
     }
 
     // write to buffer
@@ -333,7 +1051,10 @@ static int _json2string(json *js, string_buf *buf, int indent, int level)
     level++;
 
     ib_len = indent * level;
-    indent_bytes = (char *) malloc(sizeof(char) * ib_len + 1);
+    if (!(indent_bytes = (char *) json_malloc(sizeof(char) * ib_len + 1)))
+    {
+        return API_FAILURE;
+    }
     memset(indent_bytes, ' ', ib_len);
     indent_bytes[ib_len] = '\0';
 
@@ -366,7 +1087,7 @@ static int _json2string(json *js, string_buf *buf, int indent, int level)
 
                 string_buf_append(buf, "%s%s\"%s\":%s",
                     new_line_str, indent_bytes, escaped_key, space_str);
-                free(escaped_key);
+                json_free(escaped_key);
 
                 if (_json2string(pair->value, buf, indent, level) != API_SUCCESS)
                 {
@@ -384,7 +1105,7 @@ static int _json2string(json *js, string_buf *buf, int indent, int level)
         }
         case JSON_TYPE_ARRAY:
         {
-            int i = 0;
+            size_t i = 0;
 
             string_buf_append(buf, "[");
 
@@ -394,11 +1115,13 @@ static int _json2string(json *js, string_buf *buf, int indent, int level)
                 break;
             }
 
-            for (i = 0; i < json_get_size(js); i++)
+            for (i = 0; i < js->cnt; i++)
             {
                 string_buf_append(buf, "%s%s", new_line_str, indent_bytes);
 
-                if (_json2string(js->elements[i], buf, indent, level) != API_SUCCESS)
+                if (js->flags & JSON_PACKED)
+                    string_buf_append(buf, "%f", js->numbers[i]);
+                else if (_json2string(js->elements[i], buf, indent, level) != API_SUCCESS)
                 {
                     goto ERROR;
                 }
@@ -419,7 +1142,7 @@ static int _json2string(json *js, string_buf *buf, int indent, int level)
                 goto ERROR;
             }
             string_buf_append(buf, "\"%s\"", escaped_str);
-            free(escaped_str);
+            json_free(escaped_str);
             break;
         }
         case JSON_TYPE_NUMBER:
@@ -435,11 +1158,11 @@ static int _json2string(json *js, string_buf *buf, int indent, int level)
             break;
     }
 
-    free(indent_bytes);
+    json_free(indent_bytes);
     return API_SUCCESS;
 
 ERROR:
-    free(indent_bytes);
+    json_free(indent_bytes);
     return API_FAILURE;
 }
 
@@ -451,20 +1174,300 @@ char *json2string(json *js, int indent)
     string_buf buf;
     buf.cnt = 0;
     buf.alloced = 256;
-    buf.string = (char *) malloc(sizeof(char) * buf.alloced);
+    if (!(buf.string = (char *) json_malloc(sizeof(char) * buf.alloced)))
+    {
+        return NULL;
+    }
 
     indent = indent > 0 ? indent : 0;
 
-    if (_json2string(js, &buf, indent, 0) != API_SUCCESS)
+    if (_json2string(js, &buf, indent, 0) != API_SUCCESS || !buf.string)
     {
-        free(buf.string);
+        json_free(buf.string);
         return NULL;
     }
-    
+
     buf.string[buf.cnt++] = '\0';
     return buf.string;
 }
 
+/* ========== SHARING ========== */
+
+/*
+ * Add a reference to js, false if it has as many as it can count
+ */
+static bool json_ref(json *js)
+{
+    unsigned short refs = __atomic_load_n(&js->refs, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (refs == USHRT_MAX)
+            return false;
+    } while (!__atomic_compare_exchange_n(&js->refs, &refs, refs + 1, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return true;
+}
+
+/*
+ * Drop a reference to js, true if it was the last one and js is to be freed
+ */
+static bool json_unref(json *js)
+{
+    unsigned short refs = __atomic_load_n(&js->refs, __ATOMIC_ACQUIRE);
+
+    while (refs)
+    {
+        if (__atomic_compare_exchange_n(&js->refs, &refs, refs - 1, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Return another reference to js, NULL if js is NULL. Taking it is O(1): js
+ * and the values in it are shared, not copied, and a value with other
+ * references is not changed in place, the json_* functions fail on it, so that
+ * no reference sees it change. json_edit makes a new version instead, copying
+ * the values on the path to the one to change, and the values reached from a
+ * shared one through the getters, being shared with it, are changed through
+ * json_edit too. Each reference is destroyed with json_destroy, which frees the
+ * tree with the last one, and once a value has no other references it is
+ * changed in place again. Values with very many references, and those inside
+ * the block of json_compact or json_clone_into, are copied instead, and NULL
+ * returned if memory runs out
+ */
+json *json_share(json *js)
+{
+    if (!js)
+        return NULL;
+
+    // values in the block of a compacted tree go with it
+    if (!(js->flags & JSON_FIXED_NODE) && json_ref(js))
+        return js;
+    return json_clone(js);
+}
+
+/*
+ * Return a copy of js sharing the values in it, NULL if memory ran out
+ */
+static json *json_copy_node(json *js)
+{
+    json   *copy = NULL;
+    size_t  i;
+
+    switch (js->type)
+    {
+        case JSON_TYPE_OBJECT:
+            if (!(copy = json_create(JSON_TYPE_OBJECT)))
+                return NULL;
+            if (js->cnt && !(copy->members = (obj_pair **) json_malloc(sizeof(obj_pair *) * js->cnt)))
+                goto ERROR;
+            copy->alloced = js->cnt;
+
+            for (i = 0; i < js->cnt; i++)
+            {
+                obj_pair *pair = (obj_pair *) json_calloc(1, sizeof(obj_pair));
+
+                if (!pair)
+                    goto ERROR;
+                copy->members[copy->cnt++] = pair;
+                pair->key = (unsigned char *) json_strdup((char *) js->members[i]->key);
+                pair->value = json_share(js->members[i]->value);
+                if (!pair->key || !pair->value)
+                    goto ERROR;
+            }
+            return copy;
+        case JSON_TYPE_ARRAY:
+            if (!(copy = json_create(JSON_TYPE_ARRAY)))
+                return NULL;
+            if (js->cnt && !(copy->elements = (json **) json_malloc(SLOT_SIZE(js) * js->cnt)))
+                goto ERROR;
+            copy->alloced = js->cnt;
+
+            if (js->flags & JSON_PACKED)
+            {
+                if (js->cnt)
+                    memcpy(copy->numbers, js->numbers, sizeof(double) * js->cnt);
+                copy->cnt = js->cnt;
+                copy->flags |= JSON_PACKED;
+                return copy;
+            }
+
+            for (i = 0; i < js->cnt; i++)
+            {
+                if (!(copy->elements[i] = json_share(js->elements[i])))
+                    goto ERROR;
+                copy->cnt++;
+            }
+            return copy;
+        case JSON_TYPE_STRING:
+            return json_full_create(JSON_TYPE_STRING, js->string_val);
+        case JSON_TYPE_NUMBER:
+            return json_full_create(JSON_TYPE_NUMBER, &js->num_val);
+        case JSON_TYPE_BOOLEAN:
+            return json_full_create(JSON_TYPE_BOOLEAN, &js->bool_val);
+        default:
+            return json_create(js->type);
+    }
+
+ERROR:
+    json_destroy(copy);
+    return NULL;
+}
+
+/*
+ * Return the slot of the value of js named by the len bytes of name, a JSON
+ * pointer component, NULL if there is none. js is unpacked if it is a packed
+ * array
+ */
+static json **json_child_slot(json *js, const char *name, size_t len)
+{
+    json  **slot = NULL;
+    char   *key = NULL;
+    char   *end = NULL;
+    size_t  i, j;
+
+    if (!(key = (char *) json_malloc(len + 1)))
+        return NULL;
+
+    // unescape ~1 to '/' and ~0 to '~'
+    for (i = 0, j = 0; i < len; i++, j++)
+    {
+        if (name[i] == '~' && i + 1 < len && (name[i + 1] == '0' || name[i + 1] == '1'))
+            key[j] = name[++i] == '0' ? '~' : '/';
+        else
+            key[j] = name[i];
+    }
+    key[j] = '\0';
+
+    if (JSON_IS_OBJECT(js))
+    {
+        for (i = 0; i < js->cnt && !slot; i++)
+        {
+            if (strcmp(key, (char *) js->members[i]->key) == 0)
+                slot = &js->members[i]->value;
+        }
+    }
+    else if (JSON_IS_ARRAY(js) && isdigit((unsigned char) key[0]) && (key[0] != '0' || j == 1))
+    {
+        unsigned long idx = strtoul(key, &end, 10);
+
+        // the numbers of a packed array get values of their own to be edited
+        if (*end == '\0' && idx < js->cnt && json_array_unpack(js) == API_SUCCESS)
+            slot = &js->elements[idx];
+    }
+
+    json_free(key);
+    return slot;
+}
+
+/*
+ * Return the value the JSON pointer path, such as "/servers/0", leads to from
+ * *root, after giving *root sole ownership of the values on the way: those
+ * shared, see json_share, are copied and the reference to them dropped. The
+ * values in a copy are not copied but shared with the old version, so the next
+ * value on the path is copied in turn, and an edit copies as many values as
+ * the path is long. The value can then be changed with the json_* functions,
+ * unlike the values in it reached otherwise than through json_edit while they
+ * are shared. *root may be replaced by its copy. A frozen value nothing else
+ * references is not copied, as the threads reading it would be left with a
+ * freed tree: take a reference to it with json_share and edit that. A packed
+ * array on the path is unpacked, see json_array_unpack. NULL is returned if
+ * the path leads nowhere or to such a frozen value, or memory runs out, with
+ * the values copied so far kept
+ */
+json *json_edit(json **root, const char *path)
+{
+    json **slot = root;
+
+    if (!root || !*root || !path)
+        return NULL;
+
+    if (*path == '/')
+        path++;
+
+    for (;;)
+    {
+        size_t len = strcspn(path, "/");
+
+        if (JSON_IS_SHARED(*slot))
+        {
+            json *copy = json_copy_node(*slot);
+
+            if (!copy)
+                return NULL;
+            // drops our reference, the value stays with the others
+            json_destroy(*slot);
+            *slot = copy;
+        }
+        else if ((*slot)->flags & JSON_FROZEN)
+        {
+            return NULL;
+        }
+
+        if (!*path)
+            return *slot;
+
+        if (!(slot = json_child_slot(*slot, path, len)))
+            return NULL;
+
+        path += len;
+        if (*path == '/')
+            path++;
+    }
+}
+
+/*
+ * Make js and the values in it read-only before other threads read them, so
+ * that any number of threads can then call the getters, iterators and
+ * json2string on them at once without locking: the functions changing values
+ * leave frozen ones alone, and no getter changes a value. Values stay frozen.
+ * To make a new version take a reference with json_share and json_edit that
+ * one, which copies the values on the path and leaves js to its readers:
+ * json_edit on js itself returns NULL. A frozen tree is destroyed once no
+ * thread reads it. Return API_FAILURE if js is NULL or memory ran out, leaving
+ * part of it frozen
+ */
+int json_freeze(json *js)
+{
+    if (!js)
+        return API_FAILURE;
+
+    return json_walk(&js, freeze_node, freeze_leave, NULL) ? API_SUCCESS : API_FAILURE;
+}
+
+/*
+ * Freeze *slot if it holds no values, skip it if it is frozen already, and
+ * the values in it with it
+ */
+static bool freeze_node(json **slot, void *ctx)
+{
+    json *js = *slot;
+
+    (void) ctx;
+    if (js->flags & JSON_FROZEN)
+        return false;
+
+    if (WALK_HAS_VALUES(js))
+        return true;
+    js->flags |= JSON_FROZEN;
+    return false;
+}
+
+/*
+ * Freeze a container once the values in it are, so that a frozen value only
+ * ever holds frozen ones
+ */
+static void freeze_leave(json *js, void *ctx)
+{
+    (void) ctx;
+    js->flags |= JSON_FROZEN;
+}
+
 /* ========== OBJECT METHODS ========== */
 
 
@@ -499,7 +1502,7 @@ obj_pair *_json_obj_end()
  */
 bool json_object_has_key(json *object, const char *key)
 {
-    int i = 0;
+    size_t i = 0;
 
     if (!JSON_IS_OBJECT(object) || !key)
         return false;
@@ -516,7 +1519,7 @@ bool json_object_has_key(json *object, const char *key)
 
 static bool json_object_has_value(json *object, const void *val, json_type type)
 {
-    int i = 0;
+    size_t i = 0;
 
     if (!JSON_IS_OBJECT(object))
         return false;
@@ -565,7 +1568,7 @@ bool json_object_has_string(json *object, const char *string)
  */
 json *json_object_get(json *object, const char *key)
 {
-    int   i = 0;
+    size_t i = 0;
 
     if (!JSON_IS_OBJECT(object) || !key)
         return NULL;
@@ -587,7 +1590,7 @@ json *json_object_get(json *object, const char *key)
  */
 json **json_object_get_all(json *object)
 {
-    int    i = 0;
+    size_t i = 0;
     json **values = NULL;
 
     if (!JSON_IS_OBJECT(object))
@@ -595,7 +1598,10 @@ json **json_object_get_all(json *object)
         return NULL;
     }
 
-    values = (json **) calloc(object->cnt + 1, sizeof(json *));
+    if (!(values = (json **) json_calloc(object->cnt + 1, sizeof(json *))))
+    {
+        return NULL;
+    }
 
     for (i = 0; i < object->cnt; i++)
     {
@@ -608,7 +1614,7 @@ json **json_object_get_all(json *object)
 
 static int json_object_generic_get(json *object, const char *key, void *val_ptr, json_type type)
 {
-    int i = 0;
+    size_t i = 0;
 
     if (!JSON_IS_OBJECT(object) || !key || !val_ptr)
     {
@@ -656,10 +1662,10 @@ int json_object_get_string(json *object, const char *key, char **str_val)
 
 static int json_object_generic_put(json *object, const char *key, const void *val, json_type type)
 {
-    int       i = 0;
+    size_t    i = 0;
     obj_pair *pair = NULL;
 
-    if (!JSON_IS_OBJECT(object) || !key || !val)
+    if (!JSON_IS_OBJECT(object) || JSON_IS_READONLY(object) || !key || !val)
     {
         return API_FAILURE;
     }
@@ -668,34 +1674,53 @@ static int json_object_generic_put(json *object, const char *key, const void *va
     {
         if (strcmp(key, (char *) object->members[i]->key) == 0)
         {
-            json_destroy(object->members[i]->value);
-            object->members[i]->value = json_full_create(type, val);
-            return API_SUCCESS;
+            return json_replace(&object->members[i]->value, type, val);
         }
     }
 
-    pair = (obj_pair *) calloc(1, sizeof(obj_pair));
-    pair->key = (unsigned char *) strdup(key);
+    if (!json_unfix(object))
+    {
+        return API_FAILURE;
+    }
 
-    if (IS_PRIMITIVE_TYPE(type))
+    if (object->cnt == object->alloced)
     {
-        pair->value = json_full_create(type, val);
+        obj_pair **members = (obj_pair **) json_realloc(object->members,
+            sizeof(obj_pair *) * (object->alloced + 10));
+
+        if (!members)
+        {
+            return API_FAILURE;
+        }
+        object->members = members;
+        object->alloced += 10;
     }
-    else
+
+    if (!(pair = (obj_pair *) json_calloc(1, sizeof(obj_pair)))
+        || !(pair->key = (unsigned char *) json_strdup(key)))
     {
-        pair->value = (json *) val;
+        goto ERROR;
     }
-    
 
-    if (object->cnt == object->alloced)
+    if (IS_PRIMITIVE_TYPE(type))
+    {
+        if (!(pair->value = json_full_create(type, val)))
+            goto ERROR;
+    }
+    else
     {
-        object->alloced += 10;
-        object->members = (obj_pair **) realloc(object->members, 
-            sizeof(obj_pair *) * object->alloced);
+        pair->value = (json *) val;
     }
 
     object->members[object->cnt++] = pair;
     return API_SUCCESS;
+
+ERROR:
+    // a complex value stays the caller's
+    if (pair)
+        json_free(pair->key);
+    json_free(pair);
+    return API_FAILURE;
 }
 
 /*
@@ -737,35 +1762,90 @@ int json_object_put_complex_value(json *object, const char *key, json *value)
 }
 
 /*
- * Remove the pair(s) with given key
+ * Destroy the pair of object, which the caller takes out of its members
  */
-void json_object_remove_member(json *object, const char *key)
+static void json_object_drop(json *object, obj_pair *pair)
 {
-    int i = 0;
-    int j = 0;
-    int num_rem = 0;  
+    // pairs moved by json_compact go with their root's block
+    if (object->flags & JSON_FIXED_BUF)
+        json_destroy(pair->value);
+    else
+        pair_destroy(pair);
+}
 
-    if (!JSON_IS_OBJECT(object) || !key)
-        return;
+static bool json_object_key_is(const char *key, json *value, void *ctx)
+{
+    (void) value;
+    return strcmp(key, (const char *) ctx) == 0;
+}
 
-    for (i = 0; i < object->cnt; i++)
+/*
+ * Remove the pair(s) with given key. Return API_FAILURE if object is not an
+ * object or can't be changed, being shared or frozen
+ */
+int json_object_remove_member(json *object, const char *key)
+{
+    if (!JSON_IS_OBJECT(object) || JSON_IS_READONLY(object) || !key)
+        return API_FAILURE;
+
+    json_object_remove_if(object, json_object_key_is, (void *) key);
+    return API_SUCCESS;
+}
+
+/*
+ * Remove the pair(s) with given key, moving the last pairs into their places
+ * instead of shifting the ones after them. The order of the members changes.
+ * Return API_FAILURE if object is not an object or can't be changed
+ */
+int json_object_swap_remove(json *object, const char *key)
+{
+    size_t i = 0;
+
+    if (!JSON_IS_OBJECT(object) || JSON_IS_READONLY(object) || !key)
+        return API_FAILURE;
+
+    while (i < object->cnt)
     {
-        if (strcmp(key, (char *)object->members[i]->key) == 0)
+        if (strcmp(key, (char *) object->members[i]->key) == 0)
+        {
+            json_object_drop(object, object->members[i]);
+            object->members[i] = object->members[--object->cnt];
+        }
+        else
         {
-            pair_destroy(object->members[i]);
+            i++;
+        }
+    }
 
-            // shift items to the left
-            for (j = i + 1; j < object->cnt; j++)
-            {
-                object->members[j - 1] = object->members[j];
-            }
+    return API_SUCCESS;
+}
 
-            num_rem++;
-        }
+/*
+ * Remove the pairs pred returns true for, in one pass keeping the order of the
+ * others, and return how many went. pred may not change the object
+ */
+size_t json_object_remove_if(json *object, json_member_pred pred, void *ctx)
+{
+    size_t i = 0;
+    size_t kept = 0;
+    size_t removed = 0;
+
+    if (!JSON_IS_OBJECT(object) || JSON_IS_READONLY(object) || !pred)
+        return 0;
+
+    for (i = 0; i < object->cnt; i++)
+    {
+        obj_pair *pair = object->members[i];
+
+        if (pred((const char *) pair->key, pair->value, ctx))
+            json_object_drop(object, pair);
+        else
+            object->members[kept++] = pair;
     }
 
-    object->cnt -= num_rem;
-    object->alloced -= num_rem;
+    removed = object->cnt - kept;
+    object->cnt = kept;
+    return removed;
 }
 
 
@@ -773,11 +1853,14 @@ void json_object_remove_member(json *object, const char *key)
 
 static bool json_array_has_value(json *array, const void *val, json_type type)
 {
-    int i = 0;
+    size_t i = 0;
 
     if (!JSON_IS_ARRAY(array))
         return false;
 
+    if (array->flags & JSON_PACKED)
+        return json_array_index_of(array, val, type) >= 0;
+
     for (i = 0; i < array->cnt; i++)
     {
         if (json_is_equal(array->elements[i], val, type))
@@ -816,12 +1899,17 @@ bool json_array_has_string(json *array, const char *string)
 
 
 /*
- * Get the array value corresponding to given index
+ * Get the array value corresponding to given index. Arrays are only packed
+ * when asked for with JSON_PARSE_PACK_NUMBERS, and a packed array holds numbers
+ * but no values to hand out: json_get_size counts its numbers, which are read
+ * with json_array_get_number(s), and json_array_get gives NULL for each until
+ * the array is given values with json_array_unpack
  */
-json *json_array_get(json *array, int idx)
+json *json_array_get(json *array, ssize_t idx)
 {
     if (JSON_IS_ARRAY(array) 
-        && IDX_WITHIN_BOUNDS(array, idx))
+        && IDX_WITHIN_BOUNDS(array, idx)
+        && !(array->flags & JSON_PACKED))
     {
         return array->elements[idx];
     }
@@ -829,7 +1917,7 @@ json *json_array_get(json *array, int idx)
 }
 
 
-static int json_array_generic_get(json *array, int idx, void *val_ptr, json_type type)
+static int json_array_generic_get(json *array, ssize_t idx, void *val_ptr, json_type type)
 {
     if (!JSON_IS_ARRAY(array) 
         || !IDX_WITHIN_BOUNDS(array, idx)
@@ -838,6 +1926,14 @@ static int json_array_generic_get(json *array, int idx, void *val_ptr, json_type
         return API_FAILURE;
     }
 
+    if (array->flags & JSON_PACKED)
+    {
+        if (type != JSON_TYPE_NUMBER)
+            return API_FAILURE;
+        *(double *) val_ptr = array->numbers[idx];
+        return API_SUCCESS;
+    }
+
     if (JSON_HAS_TYPE(array->elements[idx], type))
     {
         json_shallow_copy(array->elements[idx], val_ptr, type);
@@ -849,7 +1945,7 @@ static int json_array_generic_get(json *array, int idx, void *val_ptr, json_type
 /*
  * Get the number corresponding to given index
  */
-int json_array_get_number(json *array, int idx, double *number)
+int json_array_get_number(json *array, ssize_t idx, double *number)
 {
     return json_array_generic_get(array, idx, number, JSON_TYPE_NUMBER);
 }
@@ -858,7 +1954,7 @@ int json_array_get_number(json *array, int idx, double *number)
 /*
  * Get the boolean corresponding to given index
  */
-int json_array_get_boolean(json *array, int idx, bool *bool_val)
+int json_array_get_boolean(json *array, ssize_t idx, bool *bool_val)
 {
     return json_array_generic_get(array, idx, bool_val, JSON_TYPE_BOOLEAN);
 }
@@ -867,29 +1963,173 @@ int json_array_get_boolean(json *array, int idx, bool *bool_val)
 /*
  * Get the string corresponding to given index
  */
-int json_array_get_string(json *array, int idx, char **str_val)
+int json_array_get_string(json *array, ssize_t idx, char **str_val)
 {
     return json_array_generic_get(array, idx, str_val, JSON_TYPE_STRING);
 }
 
 /*
- * Return real array of elements making the json array
+ * Return real array of elements making the json array, NULL for a packed one
+ * with numbers only, see json_array_get
  */
  json **json_array_get_elements(json *array)
  {
-    if (!JSON_IS_ARRAY(array))
+    if (!JSON_IS_ARRAY(array) || (array->flags & JSON_PACKED))
     {
         return NULL;
     }
     return array->elements;
  }
 
-static int json_array_index_of(json *array, const void *val, json_type type)
+/*
+ * Check the arguments of a bulk getter and set cnt to the number of values it
+ * takes from array into a buffer of n
+ */
+static bool json_array_bulk_count(json *array, const void *out, size_t n, size_t *cnt,
+    size_t *written)
 {
-    int i = 0;
+    if (written)
+        *written = 0;
 
-    if (!JSON_IS_ARRAY(array))
+    if (!JSON_IS_ARRAY(array) || !out)
+        return false;
+
+    *cnt = array->cnt < n ? array->cnt : n;
+    return true;
+}
+
+/*
+ * Copy the first n numbers of array, or all of them if it has fewer, to out
+ * and their count to written, which may be NULL. Fails at the first value that
+ * is not a number, leaving the numbers before it in out
+ */
+int json_array_get_numbers(json *array, double *out, size_t n, size_t *written)
+{
+    size_t cnt, i;
+
+    if (!json_array_bulk_count(array, out, n, &cnt, written))
+        return API_FAILURE;
+
+    if (array->flags & JSON_PACKED)
+    {
+        if (cnt)
+            memcpy(out, array->numbers, sizeof(double) * cnt);
+        i = cnt;
+    }
+    else
+    {
+        for (i = 0; i < cnt && JSON_IS_NUMBER(array->elements[i]); i++)
+            out[i] = array->elements[i]->num_val;
+    }
+
+    if (written)
+        *written = i;
+    return i == cnt ? API_SUCCESS : API_FAILURE;
+}
+
+/*
+ * Like json_array_get_numbers for numbers that are integers within the range of
+ * int64_t, failing at the first value that is not one
+ */
+int json_array_get_int64s(json *array, int64_t *out, size_t n, size_t *written)
+{
+    size_t cnt, i;
+
+    if (!json_array_bulk_count(array, out, n, &cnt, written))
+        return API_FAILURE;
+
+    for (i = 0; i < cnt; i++)
+    {
+        double number;
+
+        if (array->flags & JSON_PACKED)
+            number = array->numbers[i];
+        else if (JSON_IS_NUMBER(array->elements[i]))
+            number = array->elements[i]->num_val;
+        else
+            break;
+
+        // 2^63 is the first double past the largest int64_t
+        if (!(number >= -9223372036854775808.0 && number < 9223372036854775808.0)
+            || (double) (int64_t) number != number)
+            break;
+        out[i] = (int64_t) number;
+    }
+
+    if (written)
+        *written = i;
+    return i == cnt ? API_SUCCESS : API_FAILURE;
+}
+
+/*
+ * Like json_array_get_numbers for booleans
+ */
+int json_array_get_booleans(json *array, bool *out, size_t n, size_t *written)
+{
+    size_t cnt, i = 0;
+
+    if (!json_array_bulk_count(array, out, n, &cnt, written))
+        return API_FAILURE;
+
+    if (!(array->flags & JSON_PACKED))
+    {
+        for (i = 0; i < cnt && JSON_IS_BOOLEAN(array->elements[i]); i++)
+            out[i] = array->elements[i]->bool_val;
+    }
+
+    if (written)
+        *written = i;
+    return i == cnt ? API_SUCCESS : API_FAILURE;
+}
+
+/*
+ * Like json_array_get_numbers for strings, which are not copied: the views
+ * point into the tree
+ */
+int json_array_get_strings(json *array, json_string_view *out, size_t n, size_t *written)
+{
+    size_t cnt, i = 0;
+
+    if (!json_array_bulk_count(array, out, n, &cnt, written))
+        return API_FAILURE;
+
+    if (!(array->flags & JSON_PACKED))
+    {
+        for (i = 0; i < cnt && JSON_IS_STRING(array->elements[i]); i++)
+        {
+            out[i].str = (const char *) array->elements[i]->string_val;
+            out[i].len = array->elements[i]->cnt;
+        }
+    }
+
+    if (written)
+        *written = i;
+    return i == cnt ? API_SUCCESS : API_FAILURE;
+}
+
+static ssize_t json_array_index_of(json *array, const void *val, json_type type)
+{
+    size_t i = 0;
+
+    if (!JSON_IS_ARRAY(array) || !val)
+    {
+        return -1;
+    }
+
+    if (array->flags & JSON_PACKED)
     {
+        const double *numbers = array->numbers;
+        double        number;
+
+        if (type != JSON_TYPE_NUMBER)
+            return -1;
+
+        number = *(const double *) val;
+        for (i = 0; i < array->cnt; i++)
+        {
+            if (numbers[i] == number)
+                return (ssize_t) i;
+        }
         return -1;
     }
 
@@ -897,7 +2137,7 @@ static int json_array_index_of(json *array, const void *val, json_type type)
     {
         if (json_is_equal(array->elements[i], val, type))
         {
-            return i;
+            return (ssize_t) i;
         }
     }
 
@@ -907,7 +2147,7 @@ static int json_array_index_of(json *array, const void *val, json_type type)
 /*
  * Get first index of given number in array
  */
-int json_array_index_of_number(json *array, double number)
+ssize_t json_array_index_of_number(json *array, double number)
 {
     return json_array_index_of(array, &number, JSON_TYPE_NUMBER);
 }
@@ -915,7 +2155,7 @@ int json_array_index_of_number(json *array, double number)
 /*
  * Get first index of given boolean in array
  */
-int json_array_index_of_boolean(json *array, bool bool_val)
+ssize_t json_array_index_of_boolean(json *array, bool bool_val)
 {
     return json_array_index_of(array, &bool_val, JSON_TYPE_BOOLEAN);
 }
@@ -923,7 +2163,7 @@ int json_array_index_of_boolean(json *array, bool bool_val)
 /*
  * Get first index of given string in array
  */
-int json_array_index_of_string(json *array, const char *str_val)
+ssize_t json_array_index_of_string(json *array, const char *str_val)
 {
     return json_array_index_of(array, str_val, JSON_TYPE_STRING);
 }
@@ -931,9 +2171,10 @@ int json_array_index_of_string(json *array, const char *str_val)
 /*
  * Put a value in an array
  */
-static int json_array_generic_add(json *array, int idx, json_type type, const void *val)
+static int json_array_generic_add(json *array, ssize_t idx, json_type type, const void *val)
 {
     if (!JSON_IS_ARRAY(array) 
+        || JSON_IS_READONLY(array)
         || !IDX_WITHIN_BOUNDS(array, idx))
     {
         return API_FAILURE;
@@ -941,17 +2182,22 @@ static int json_array_generic_add(json *array, int idx, json_type type, const vo
 
     assert(type > JSON_TYPE_NONE || type < JSON_TYPE_END);
 
-    // destroy original element and create a new one;
-    json_destroy(array->elements[idx]); // TODO can we reuse memory instead of deallocating?
-    array->elements[idx] = json_full_create(type, val);
+    if ((array->flags & JSON_PACKED) && type == JSON_TYPE_NUMBER)
+    {
+        array->numbers[idx] = *(double *) val;
+        return API_SUCCESS;
+    }
+
+    if (json_array_unpack(array) != API_SUCCESS)
+        return API_FAILURE;
 
-    return API_SUCCESS;
+    return json_replace(&array->elements[idx], type, val);
 }
 
 /*
  * Put a number at given index in an array
  */
-int json_array_add_number(json *array, int idx, double number)
+int json_array_add_number(json *array, ssize_t idx, double number)
 {
     return json_array_generic_add(array, idx, JSON_TYPE_NUMBER, &number);
 }
@@ -959,7 +2205,7 @@ int json_array_add_number(json *array, int idx, double number)
 /*
  * Put a boolean at given index in an array
  */
-int json_array_add_boolean(json *array, int idx, bool bool_val)
+int json_array_add_boolean(json *array, ssize_t idx, bool bool_val)
 {
     return json_array_generic_add(array, idx, JSON_TYPE_BOOLEAN, &bool_val);
 }
@@ -967,119 +2213,344 @@ int json_array_add_boolean(json *array, int idx, bool bool_val)
 /*
  * Put a string at given index in an array
  */
-int json_array_add_string(json *array, int idx, const char *str_val)
+int json_array_add_string(json *array, ssize_t idx, const char *str_val)
 {
     return json_array_generic_add(array, idx, JSON_TYPE_STRING, str_val);
 }
 
-static void json_array_append(json *array, const void *val, json_type type)
+static int json_array_append(json *array, const void *val, json_type type)
 {
-    json *js = NULL;
+    // the batch inserts take arrays of values
+    const void *vals = (type == JSON_TYPE_STRING) ? (const void *) &val : val;
 
-    assert(NULL == js);
+    return json_array_insert_values(array, json_get_size(array), vals, 1, type);
+}
 
-    if (!JSON_IS_ARRAY(array) 
-        || !IS_PRIMITIVE_TYPE(type))
+/*
+ * Append a number to a given array. Return API_FAILURE if array is not an
+ * array, can't be changed, being shared or frozen, or memory ran out
+ */
+int json_array_append_number(json *array, double number)
+{
+    return json_array_append(array, &number, JSON_TYPE_NUMBER);
+}
+
+/*
+ * Append a boolean to a given array, see json_array_append_number
+ */
+int json_array_append_boolean(json *array, bool bool_val)
+{
+    return json_array_append(array, &bool_val, JSON_TYPE_BOOLEAN);
+}
+
+/*
+ * Append a string to a given array, see json_array_append_number
+ */
+int json_array_append_string(json *array, const char *str_val)
+{
+    return json_array_append(array, str_val, JSON_TYPE_STRING);
+}
+
+/*
+ * Make room in array for at least capacity elements, so that appending up to
+ * them does not reallocate
+ */
+int json_array_reserve(json *array, size_t capacity)
+{
+    if (!JSON_IS_ARRAY(array) || JSON_IS_READONLY(array))
     {
-        return;
+        return API_FAILURE;
+    }
+
+    if (!json_unfix(array))
+    {
+        return API_FAILURE;
+    }
+
+    if (capacity <= array->alloced)
+    {
+        return API_SUCCESS;
+    }
+
+    return json_array_grow(array, capacity) ? API_SUCCESS : API_FAILURE;
+}
+
+/*
+ * Reallocate the elements of array to hold cnt of them
+ */
+static bool json_array_grow(json *array, size_t cnt)
+{
+    void *elements = json_realloc(array->elements, SLOT_SIZE(array) * cnt);
+
+    if (!elements)
+        return false;
+
+    array->elements = (json **) elements;
+    array->alloced = cnt;
+    return true;
+}
+
+/*
+ * Insert the n values of vals, an array of double, bool or const char * by
+ * type, at idx in array, moving the elements from idx on only once. Either all
+ * of them go in or, on failure, none
+ */
+static int json_array_insert_values(json *array, ssize_t idx, const void *vals, size_t n,
+    json_type type)
+{
+    size_t i;
+
+    if (!JSON_IS_ARRAY(array)
+        || JSON_IS_READONLY(array)
+        || idx < 0 || (size_t) idx > array->cnt
+        || !IS_PRIMITIVE_TYPE(type)
+        || (n && !vals))
+    {
+        return API_FAILURE;
+    }
+
+    if (!n)
+        return API_SUCCESS;
+
+    if (!json_unfix(array)
+        || (type != JSON_TYPE_NUMBER && json_array_unpack(array) != API_SUCCESS))
+    {
+        return API_FAILURE;
+    }
+
+    // grow by half at least, so that appending one value at a time stays linear
+    if (array->cnt + n > array->alloced)
+    {
+        size_t grow = array->alloced / 2 + 10;
+
+        if (!json_array_grow(array, array->cnt + (n > grow ? n : grow)))
+            return API_FAILURE;
+    }
+
+    if (array->flags & JSON_PACKED)
+    {
+        if ((size_t) idx < array->cnt)
+            memmove(array->numbers + idx + n, array->numbers + idx,
+                sizeof(double) * (array->cnt - idx));
+        memcpy(array->numbers + idx, vals, sizeof(double) * n);
+        array->cnt += n;
+        return API_SUCCESS;
     }
 
-    js = json_full_create(type, val);
-    if (array->cnt == array->alloced)
+    if ((size_t) idx < array->cnt)
+        memmove(array->elements + idx + n, array->elements + idx,
+            sizeof(json *) * (array->cnt - idx));
+
+    for (i = 0; i < n; i++)
     {
-        array->alloced += 10;
-        array->elements = (json **) realloc(array->elements, 
-            sizeof(json *) * array->alloced);
+        const void *val = NULL;
+
+        switch (type)
+        {
+            case JSON_TYPE_NUMBER:
+                val = (const double *) vals + i;
+                break;
+            case JSON_TYPE_BOOLEAN:
+                val = (const bool *) vals + i;
+                break;
+            default:
+                val = ((const char *const *) vals)[i];
+                break;
+        }
+
+        if (!val || !(array->elements[idx + i] = json_full_create(type, val)))
+        {
+            // take the values back out
+            while (i > 0)
+                json_destroy(array->elements[idx + --i]);
+            if ((size_t) idx < array->cnt)
+                memmove(array->elements + idx, array->elements + idx + n,
+                    sizeof(json *) * (array->cnt - idx));
+            return API_FAILURE;
+        }
     }
 
-    array->elements[array->cnt++] = js;
+    array->cnt += n;
+    return API_SUCCESS;
+}
+
+/*
+ * Append the n numbers of numbers to array
+ */
+int json_array_append_numbers(json *array, const double *numbers, size_t n)
+{
+    return json_array_insert_values(array, json_get_size(array), numbers, n, JSON_TYPE_NUMBER);
+}
+
+/*
+ * Append the n booleans of bools to array
+ */
+int json_array_append_booleans(json *array, const bool *bools, size_t n)
+{
+    return json_array_insert_values(array, json_get_size(array), bools, n, JSON_TYPE_BOOLEAN);
 }
 
 /*
- * Append a number to a given array
+ * Append copies of the n strings of strs to array
  */
-void json_array_append_number(json *array, double number)
+int json_array_append_strings(json *array, const char *const *strs, size_t n)
 {
-    json_array_append(array, &number, JSON_TYPE_NUMBER);
+    return json_array_insert_values(array, json_get_size(array), strs, n, JSON_TYPE_STRING);
 }
 
 /*
- * Append a boolean to a given array
+ * Insert the n numbers of numbers at idx in array, which may be its size
  */
-void json_array_append_boolean(json *array, bool bool_val)
+int json_array_insert_numbers(json *array, ssize_t idx, const double *numbers, size_t n)
 {
-    json_array_append(array, &bool_val, JSON_TYPE_BOOLEAN);
+    return json_array_insert_values(array, idx, numbers, n, JSON_TYPE_NUMBER);
 }
 
 /*
- * Append a string to a given array
+ * Insert the n booleans of bools at idx in array, which may be its size
  */
-void json_array_append_string(json *array, const char *str_val)
+int json_array_insert_booleans(json *array, ssize_t idx, const bool *bools, size_t n)
 {
-    json_array_append(array, str_val, JSON_TYPE_STRING);
+    return json_array_insert_values(array, idx, bools, n, JSON_TYPE_BOOLEAN);
 }
 
 /*
- * Remove the element at the given index
+ * Insert copies of the n strings of strs at idx in array, which may be its size
  */
-void json_array_remove_at(json *array, int idx)
+int json_array_insert_strings(json *array, ssize_t idx, const char *const *strs, size_t n)
 {
-    int   i = 0;
-    json *js;
+    return json_array_insert_values(array, idx, strs, n, JSON_TYPE_STRING);
+}
 
+/*
+ * Remove the element at the given index. Return API_FAILURE if there is none
+ * or array can't be changed, being shared or frozen
+ */
+int json_array_remove_at(json *array, ssize_t idx)
+{
     if (!JSON_IS_ARRAY(array) 
+        || JSON_IS_READONLY(array)
         || !IDX_WITHIN_BOUNDS(array, idx))
     {
-        return;
+        return API_FAILURE;
     }
 
-    // destroy element
-    js = array->elements[idx];
-    json_destroy(js);
+    if (!(array->flags & JSON_PACKED))
+        json_destroy(array->elements[idx]);
+
+    // shift elements, the allocation stays as it is
+    memmove((char *) array->elements + idx * SLOT_SIZE(array),
+        (char *) array->elements + (idx + 1) * SLOT_SIZE(array),
+        (array->cnt - idx - 1) * SLOT_SIZE(array));
+    array->cnt--;
+    return API_SUCCESS;
+}
 
-    // shift elements
-    for (i = idx + 1; i < array->cnt; i++)
+/*
+ * Remove the element at the given index, moving the last element into its
+ * place instead of shifting the ones after it. The order of the elements
+ * changes. Return API_FAILURE like json_array_remove_at
+ */
+int json_array_swap_remove(json *array, ssize_t idx)
+{
+    if (!JSON_IS_ARRAY(array) 
+        || JSON_IS_READONLY(array)
+        || !IDX_WITHIN_BOUNDS(array, idx))
     {
-        array->elements[i - 1] = array->elements[i];
+        return API_FAILURE;
     }
 
     array->cnt--;
-    array->alloced--;
+    if (array->flags & JSON_PACKED)
+    {
+        array->numbers[idx] = array->numbers[array->cnt];
+        return API_SUCCESS;
+    }
+
+    json_destroy(array->elements[idx]);
+    array->elements[idx] = array->elements[array->cnt];
+    return API_SUCCESS;
+}
+
+/*
+ * Remove the elements pred returns true for, in one pass keeping the order of
+ * the others, and return how many went. pred may not change the array. The
+ * numbers of a packed array are given to it in a value that lasts the call only
+ */
+size_t json_array_remove_if(json *array, json_value_pred pred, void *ctx)
+{
+    size_t i = 0;
+    size_t kept = 0;
+    size_t removed = 0;
+
+    if (!JSON_IS_ARRAY(array) || JSON_IS_READONLY(array) || !pred)
+        return 0;
+
+    if (array->flags & JSON_PACKED)
+    {
+        json number;
+
+        memset(&number, 0, sizeof(json));
+        number.type = JSON_TYPE_NUMBER;
+        for (i = 0; i < array->cnt; i++)
+        {
+            number.num_val = array->numbers[i];
+            if (!pred(&number, ctx))
+                array->numbers[kept++] = array->numbers[i];
+        }
+    }
+    else
+    {
+        for (i = 0; i < array->cnt; i++)
+        {
+            json *js = array->elements[i];
+
+            if (pred(js, ctx))
+                json_destroy(js);
+            else
+                array->elements[kept++] = js;
+        }
+    }
+
+    removed = array->cnt - kept;
+    array->cnt = kept;
+    return removed;
 }
 
-static void json_array_remove_element(json *array, const void *elem, json_type type)
+static int json_array_remove_element(json *array, const void *elem, json_type type)
 {
     // more efficient to remove element in one loop, but delegation is neat:)
-    int idx = json_array_index_of(array, elem, type);
+    ssize_t idx = json_array_index_of(array, elem, type);
 
     if (idx < 0)
     {
-        return;
+        return API_FAILURE;
     }
 
-    json_array_remove_at(array, idx);
+    return json_array_remove_at(array, idx);
 }
 
 /*
- * Remove the first occurence of a number
+ * Remove the first occurence of a number. Return API_FAILURE if there is none
+ * or array can't be changed, being shared or frozen
  */
-void json_array_remove_number(json *array, double number)
+int json_array_remove_number(json *array, double number)
 {
-    json_array_remove_element(array, &number, JSON_TYPE_NUMBER);
+    return json_array_remove_element(array, &number, JSON_TYPE_NUMBER);
 }
 
 /*
- * Remove the first occurence of a boolean
+ * Remove the first occurence of a boolean, see json_array_remove_number
  */
-void json_array_remove_boolean(json *array, bool bool_val)
+int json_array_remove_boolean(json *array, bool bool_val)
 {
-    json_array_remove_element(array, &bool_val, JSON_TYPE_BOOLEAN);
+    return json_array_remove_element(array, &bool_val, JSON_TYPE_BOOLEAN);
 }
 
 /*
- * Remove the first occurence of a string
+ * Remove the first occurence of a string, see json_array_remove_number
  */
-void json_array_remove_string(json *array, const char *str_val)
+int json_array_remove_string(json *array, const char *str_val)
 {
-    json_array_remove_element(array, str_val, JSON_TYPE_STRING);
+    return json_array_remove_element(array, str_val, JSON_TYPE_STRING);
 }
@@ -1,7 +1,11 @@
 #ifndef JSON_H
 #define JSON_H
 
+#include <stdio.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 typedef enum json_type
 {
@@ -35,7 +39,7 @@ typedef enum json_type
 #define JSON_HAS_SIZE(js)           ((js->type == JSON_TYPE_STRING) \
                                      || (js->type == JSON_TYPE_ARRAY) \
                                      || (js->type == JSON_TYPE_OBJECT))
-#define IDX_WITHIN_BOUNDS(js, idx)  ((idx) > -1 && (idx) < (js)->cnt)
+#define IDX_WITHIN_BOUNDS(js, idx)  ((idx) > -1 && (size_t) (idx) < (js)->cnt)
 
 
 typedef struct JSON json;
@@ -47,32 +51,57 @@ struct json_object_pair {
     json          *value;
 };
 
+/* storage of values relocated by json_compact */
+#define JSON_FIXED_NODE             0x1 // the value lives in its root's block, not freed alone
+#define JSON_FIXED_BUF              0x2 // so do its string or members, with their pairs and keys
+
+/* an array of numbers only, kept as a double[] in numbers, see json_array_unpack */
+#define JSON_PACKED                 0x4
+
+/* read-only and safe to read from any number of threads, see json_freeze */
+#define JSON_FROZEN                 0x8
+
+/* true if js has more than one reference, see json_share */
+#define JSON_IS_SHARED(js)          (__atomic_load_n(&(js)->refs, __ATOMIC_ACQUIRE) != 0)
+/* true if js is not to be changed in place, see json_share and json_freeze */
+#define JSON_IS_READONLY(js)        (((js)->flags & JSON_FROZEN) || JSON_IS_SHARED(js))
+
 /* json value object */
 struct JSON
 {
     json_type type;
-    int       cnt;     // used for objects and arrays
-    int       alloced; // used for objects and arrays
+    unsigned short flags; // JSON_FIXED_* flags, 0 for values from malloc, and JSON_PACKED
+    unsigned short refs;  // references besides the first, see json_share
     union {
         obj_pair  **members; // used for objects
         json      **elements; // used for arrays
+        double     *numbers; // used for packed arrays
         double      num_val; // used for numbers
         bool        bool_val; // used for boolean
         unsigned char *string_val; // used for strings    
     };
+    // numbers, booleans and null end here, see JSON_NODE_SIZE
+    size_t    cnt;     // used for strings, objects and arrays
+    size_t    alloced; // used for strings, objects and arrays
 };
 
+/* bytes allocated for a value of type t */
+#define JSON_NODE_SIZE(t)           (((t) == JSON_TYPE_STRING \
+                                      || (t) == JSON_TYPE_ARRAY \
+                                      || (t) == JSON_TYPE_OBJECT) \
+                                     ? sizeof(json) : offsetof(json, cnt))
+
 typedef struct json_obj_iter {
-    json *obj;
-    int   idx;
+    json    *obj;
+    ssize_t  idx;
 } json_obj_iter;
 
 /* the parser output returned to the user */
 typedef struct 
 {
-    json *root;
-    int   error;
-    int   buffer_idx;
+    json   *root;
+    int     error;
+    size_t  buffer_idx;
 } json_output;
 
 
@@ -80,13 +109,120 @@ typedef struct
 #define API_FAILURE    1
 
 
+/* a document read from newline delimited JSON */
+typedef struct json_record
+{
+    json   *root;      // owned by the caller, NULL on error
+    int     error;
+    size_t  error_loc; // offset of the error within the line
+    size_t  line;      // line number starting from 1
+} json_record;
+
+typedef struct json_ndjson json_ndjson;
+
+typedef struct json_stream json_stream;
+
+typedef struct json_parser_ctx json_parser_ctx;
+
+/* settings of the parallel parsers, zeroes pick the defaults */
+typedef struct json_parallel_options
+{
+    int     threads;     // worker threads, default: the online CPUs
+    size_t  chunk_size;  // bytes of input per work item, default 1MB
+    size_t  queue_depth; // parsed chunks kept ahead of the reader, default 2 * threads
+    bool    unordered;   // give records out as chunks finish, not in input order
+} json_parallel_options;
+
+
+/* json_parse_ex options */
+#define JSON_PARSE_TRUSTED          0x1 // input known to be valid, see json_parse_ex
+#define JSON_PARSE_EXACT_SIZE       0x2 // count the members of containers a window ahead of building them
+#define JSON_PARSE_PACK_NUMBERS     0x4 // keep arrays holding only numbers as a double[],
+                                        // read with the number getters, see json_array_get
+
+/* functions the library allocates memory with, ctx is passed to each of them */
+typedef struct json_allocator
+{
+    void *(*malloc_fn)(size_t size, void *ctx);
+    void *(*realloc_fn)(void *ptr, size_t size, void *ctx);
+    void  (*free_fn)(void *ptr, void *ctx);
+    void   *ctx;
+} json_allocator;
+
+typedef struct json_parse_options
+{
+    int                    flags;     // JSON_PARSE_* flags
+    const json_allocator  *allocator; // for this parse only, NULL for the usual one
+    size_t                 max_bytes; // memory the tree may take, 0 for no limit
+} json_parse_options;
+
+
+/* json_parse_file flags */
+#define JSON_FILE_POPULATE          0x1 // read the whole file in when mapping it
+#define JSON_FILE_SEQUENTIAL        0x2 // advise the kernel to read ahead
+
+
+/* json_parse_filter handling */
+typedef enum json_filter_op
+{
+    JSON_FILTER_EQ,
+    JSON_FILTER_NE,
+    JSON_FILTER_LT,
+    JSON_FILTER_LE,
+    JSON_FILTER_GT,
+    JSON_FILTER_GE,
+} json_filter_op;
+
+typedef struct json_filter
+{
+    const char     *path; // field of the record e.g "/region/id"
+    json_filter_op  op;
+    json_type       type; // type of the value the field is compared against
+    union {
+        double      num_val;
+        bool        bool_val;
+        const char *string_val;
+    };
+} json_filter;
+
+
+/* memory taken by a tree, see json_memory_usage */
+typedef struct json_memory
+{
+    size_t  nodes;      // the values and the pairs of objects
+    size_t  keys;       // object keys
+    size_t  strings;    // string values, with their terminating NUL
+    size_t  containers; // member and element slots in use
+    size_t  slack;      // allocated but unused bytes of strings and containers
+    size_t  total;
+} json_memory;
+
+/* json_compact flags */
+#define JSON_COMPACT_CONTIGUOUS     0x1 // move the tree into one block in depth first order
+
+/* a string of a tree, valid while the tree is, see json_array_get_strings */
+typedef struct json_string_view
+{
+    const char *str;
+    size_t      len;
+} json_string_view;
+
+/* predicates of json_array_remove_if and json_object_remove_if */
+typedef bool (*json_value_pred)(json *value, void *ctx);
+typedef bool (*json_member_pred)(const char *key, json *value, void *ctx);
+
 /* json2string handling */
 typedef struct {
-    int  cnt;
-    int  alloced;
-    char *string;
+    size_t  cnt;
+    size_t  alloced;
+    char   *string;
 } string_buf;
 
+/* memory APIs */
+void  json_set_allocator(const json_allocator *allocator);
+const json_allocator *json_use_allocator(const json_allocator *allocator);
+void  json_free(void *ptr);
+
 /* generic APIs */
 json *json_create(json_type type);
 json *json_full_create(json_type type, const void *val);
@@ -99,11 +235,21 @@ json *json_full_create(json_type type, const void *val);
 
 bool  json_is_empty(json *js);
 void  json_destroy(json *js);
-int   json_get_size(json *js);
+void  json_destroy_async(json *js);
+void  json_destroy_async_wait(void);
+ssize_t json_get_size(json *js);
 bool  json_is_equal2number(json *js, double number);
 bool  json_is_equal2boolean(json *js, bool bool_val);
 bool  json_is_equal2string(json *js, const char *string);
 char *json2string(json *js, int indent);
+json *json_compact(json *js, int flags);
+json *json_clone(json *js);
+size_t json_clone_size(json *js);
+json *json_clone_into(json *js, void *buf, size_t size);
+json *json_share(json *js);
+json *json_edit(json **root, const char *path);
+int   json_freeze(json *js);
+int   json_memory_usage(json *js, json_memory *usage);
 
 /* object APIs */
 struct json_obj_iter json_obj_iter_init(json *object);
@@ -127,41 +273,86 @@ int     json_object_put_boolean(json *object, const char *key, bool bool_val);
 int     json_object_put_string(json *object, const char *key, const char *str_val);
 int     json_object_put_complex_value(json *object, const char *key, json *value);
 
-void    json_object_remove_member(json *object, const char *key);
+int     json_object_remove_member(json *object, const char *key);
+int     json_object_swap_remove(json *object, const char *key);
+size_t  json_object_remove_if(json *object, json_member_pred pred, void *ctx);
 
 /* array APIs */
 bool    json_array_has_number(json *array, double number);
 bool    json_array_has_boolean(json *array, bool bool_val);
 bool    json_array_has_string(json *array, const char *string);
 
-json    *json_array_get(json *array, int idx);
-int     json_array_get_number(json *array, int idx, double *number);
-int     json_array_get_boolean(json *array, int idx, bool *bool_val);
-int     json_array_get_string(json *array, int idx, char **str_val);
+json    *json_array_get(json *array, ssize_t idx);
+int     json_array_get_number(json *array, ssize_t idx, double *number);
+int     json_array_get_boolean(json *array, ssize_t idx, bool *bool_val);
+int     json_array_get_string(json *array, ssize_t idx, char **str_val);
 json    **json_array_get_elements(json *array);
+int     json_array_unpack(json *array);
+int     json_array_get_numbers(json *array, double *out, size_t n, size_t *written);
+int     json_array_get_int64s(json *array, int64_t *out, size_t n, size_t *written);
+int     json_array_get_booleans(json *array, bool *out, size_t n, size_t *written);
+int     json_array_get_strings(json *array, json_string_view *out, size_t n, size_t *written);
+
+ssize_t json_array_index_of_number(json *array, double number);
+ssize_t json_array_index_of_boolean(json *array, bool bool_val);
+ssize_t json_array_index_of_string(json *array, const char *str_val);
 
-int     json_array_index_of_number(json *array, double number);
-int     json_array_index_of_boolean(json *array, bool bool_val);
-int     json_array_index_of_string(json *array, const char *str_val);
+int     json_array_add_number(json *array, ssize_t idx, double number);
+int     json_array_add_boolean(json *array, ssize_t idx, bool bool_val);
+int     json_array_add_string(json *array, ssize_t idx, const char *str_val);
 
-int     json_array_add_number(json *array, int idx, double number);
-int     json_array_add_boolean(json *array, int idx, bool bool_val);
-int     json_array_add_string(json *array, int idx, const char *str_val);
+int     json_array_append_number(json *array, double number);
+int     json_array_append_boolean(json *array, bool bool_val);
+int     json_array_append_string(json *array, const char *str_val);
 
-void    json_array_append_number(json *array, double number);
-void    json_array_append_boolean(json *array, bool bool_val);
-void    json_array_append_string(json *array, const char *str_val);
+int     json_array_reserve(json *array, size_t capacity);
+int     json_array_append_numbers(json *array, const double *numbers, size_t n);
+int     json_array_append_booleans(json *array, const bool *bools, size_t n);
+int     json_array_append_strings(json *array, const char *const *strs, size_t n);
+int     json_array_insert_numbers(json *array, ssize_t idx, const double *numbers, size_t n);
+int     json_array_insert_booleans(json *array, ssize_t idx, const bool *bools, size_t n);
+int     json_array_insert_strings(json *array, ssize_t idx, const char *const *strs, size_t n);
 
-void    json_array_remove_at(json *array, int idx);
-void    json_array_remove_number(json *array, double number);
-void    json_array_remove_boolean(json *array, bool bool_val);
-void    json_array_remove_string(json *array, const char *str_val);
+int     json_array_remove_at(json *array, ssize_t idx);
+int     json_array_swap_remove(json *array, ssize_t idx);
+size_t  json_array_remove_if(json *array, json_value_pred pred, void *ctx);
+int     json_array_remove_number(json *array, double number);
+int     json_array_remove_boolean(json *array, bool bool_val);
+int     json_array_remove_string(json *array, const char *str_val);
 
 /* PARSER APIs */
 json_output *json_parse(const char *json_string);
 void         json_output_destroy(json_output *jo);
 bool         json_parser_found_error(json_output *jo);
 const char  *json_parser_get_error(json_output *jo);
-int          json_parser_get_error_loc(json_output *jo);
+size_t       json_parser_get_error_loc(json_output *jo);
+bool         json_validate(const char *buf, size_t len, int *error, size_t *error_loc);
+json_output *json_parse_select(const char *buf, size_t len, const char *const *paths, size_t n);
+json_output *json_parse_filter(const char *buf, size_t len, const json_filter *filter);
+const char  *json_error2string(int error);
+json_output *json_parse_ex(const char *buf, size_t len, const json_parse_options *options);
+json_parser_ctx *json_parser_ctx_create(void);
+json_output *json_parser_ctx_parse(json_parser_ctx *ctx, const char *buf, size_t len,
+                                   const json_parse_options *options);
+void         json_parser_ctx_destroy(json_parser_ctx *ctx);
+json_output *json_parse_parallel(const char *buf, size_t len,
+                                 const json_parallel_options *options);
+json_output *json_parse_file(const char *path, int flags);
+
+/* STREAM APIs */
+// only a root array is streamed, element by element, any other root value is built whole
+json_stream *json_parse_fd(int fd, size_t buf_size);
+json_stream *json_parse_fp(FILE *fp, size_t buf_size);
+bool         json_stream_next(json_stream *stream, json **value);
+int          json_stream_get_error(json_stream *stream);
+size_t       json_stream_get_error_loc(json_stream *stream);
+void         json_stream_close(json_stream *stream);
+
+/* NDJSON APIs */
+json_ndjson *json_ndjson_open(const char *buf, size_t len);
+json_ndjson *json_ndjson_open_parallel(const char *buf, size_t len,
+                                       const json_parallel_options *options);
+bool         json_ndjson_next(json_ndjson *nd, json_record *record);
+void         json_ndjson_close(json_ndjson *nd);
 
 #endif // JSON_H
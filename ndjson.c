@@ -0,0 +1,535 @@
+/*
+ * Newline delimited JSON (JSON Lines): one JSON text per line
+ *
+ * The reader either parses the lines itself as they are asked for or, when
+ * opened with json_ndjson_open_parallel, hands chunks of lines to worker
+ * threads and gives out their records through a bounded queue.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "parser.h"
+#include "alloc.h"
+#include "utils.h"
+
+#define NDJSON_DEFAULT_CHUNK_SIZE    (1 << 20)
+
+/* a range of whole lines parsed by one worker */
+typedef struct ndjson_chunk
+{
+    size_t       start;
+    size_t       end;
+    size_t       lines;     // newlines in the chunk
+    size_t       base_line; // number of the chunk's first line
+    json_record *records;
+    size_t       cnt;
+    size_t       alloced;
+    size_t       rest;      // lines from here on are left to the reader
+    size_t       rest_line; // and numbered from here within the chunk
+    bool         done;
+} ndjson_chunk;
+
+/* state shared by the worker threads and the reader */
+typedef struct ndjson_pool
+{
+    pthread_t       *threads;
+    int              num_threads;
+    pthread_mutex_t  lock;
+    pthread_cond_t   work_cond;  // signalled when a worker may go on
+    pthread_cond_t   ready_cond; // signalled when the reader may go on
+
+    ndjson_chunk    *chunks;
+    size_t           num_chunks;
+    size_t           next_count; // next chunk to count the lines of
+    size_t           counted;
+    size_t           next_parse; // next chunk to parse
+    size_t           consumed;   // chunks the reader is done with
+    size_t           depth;      // parsed chunks allowed ahead of the reader
+    bool             unordered;
+    bool             stop;
+
+    size_t          *finished;   // parsed chunks in the order they finished
+    size_t           finished_head;
+    size_t           finished_tail;
+
+    ndjson_chunk    *current;    // chunk the reader is giving out
+    size_t           current_idx;
+
+    const json_allocator *allocator; // of the thread that opened the input
+} ndjson_pool;
+
+struct json_ndjson
+{
+    json_parser  parser; // reused for every line
+    const char  *buf;
+    size_t       len;
+    size_t       pos;    // start of the next line
+    size_t       line;   // number of the next line
+    ndjson_pool *pool;   // set when the lines are parsed by worker threads
+};
+
+static bool  ndjson_read_line(json_ndjson *nd, json_record *record);
+static bool  ndjson_pool_next(json_ndjson *nd, json_record *record);
+static bool  ndjson_chunk_read_rest(const char *buf, ndjson_chunk *chunk, json_record *record);
+static void *ndjson_worker(void *arg);
+static void  ndjson_chunk_parse(const char *buf, ndjson_chunk *chunk);
+static void  ndjson_chunk_release(ndjson_chunk *chunk, size_t handed_out);
+static void  ndjson_pool_destroy(ndjson_pool *pool);
+
+
+/*
+ * Start reading the documents in the len bytes of buf. The buffer is not
+ * copied and has to outlive the reader
+ */
+json_ndjson *json_ndjson_open(const char *buf, size_t len)
+{
+    json_ndjson *nd = NULL;
+
+    if (!buf)
+    {
+        return NULL;
+    }
+
+    if (!(nd = (json_ndjson *) json_calloc(1, sizeof(json_ndjson))))
+    {
+        return NULL;
+    }
+    nd->buf = buf;
+    nd->len = len;
+    nd->pos = 0;
+    nd->line = 1;
+    return nd;
+}
+
+/*
+ * Like json_ndjson_open but the lines are parsed by worker threads, chunk by
+ * chunk, ahead of the calls to json_ndjson_next. options may be NULL
+ */
+json_ndjson *json_ndjson_open_parallel(const char *buf, size_t len,
+    const json_parallel_options *options)
+{
+    json_parallel_options  opts = { 0, 0, 0, false };
+    json_ndjson           *nd = NULL;
+    ndjson_pool           *pool = NULL;
+    size_t                 start = 0;
+    int                    i;
+
+    if (!(nd = json_ndjson_open(buf, len)))
+    {
+        return NULL;
+    }
+
+    if (options)
+    {
+        opts = *options;
+    }
+    if (opts.threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.threads = cpus > 0 ? cpus : 1;
+    }
+    if (opts.chunk_size == 0)
+    {
+        opts.chunk_size = NDJSON_DEFAULT_CHUNK_SIZE;
+    }
+    if (opts.queue_depth == 0)
+    {
+        opts.queue_depth = 2 * opts.threads;
+    }
+
+    // without the memory for workers the lines are read in place
+    if (!(pool = (ndjson_pool *) json_calloc(1, sizeof(ndjson_pool))))
+    {
+        return nd;
+    }
+    pool->depth = opts.queue_depth;
+    pool->unordered = opts.unordered;
+    pool->allocator = json_thread_allocator();
+
+    // split the buffer after the first newline past every chunk_size bytes
+    while (start < len)
+    {
+        size_t      end = len;
+        const char *eol = NULL;
+
+        if (len - start > opts.chunk_size
+            && (eol = (const char *) memchr(buf + start + opts.chunk_size, '\n',
+                    len - start - opts.chunk_size)))
+        {
+            end = eol - buf + 1;
+        }
+
+        if (pool->num_chunks % 64 == 0)
+        {
+            ndjson_chunk *chunks = (ndjson_chunk *) json_realloc(pool->chunks,
+                sizeof(ndjson_chunk) * (pool->num_chunks + 64));
+
+            if (!chunks)
+                break;
+            pool->chunks = chunks;
+        }
+        memset(&pool->chunks[pool->num_chunks], 0, sizeof(ndjson_chunk));
+        pool->chunks[pool->num_chunks].start = start;
+        pool->chunks[pool->num_chunks].end = end;
+        pool->chunks[pool->num_chunks].rest = end;
+        pool->num_chunks++;
+        start = end;
+    }
+
+    if (start < len
+        || !(pool->finished = (size_t *) json_calloc(pool->num_chunks + 1, sizeof(size_t)))
+        || !(pool->threads = (pthread_t *) json_calloc(opts.threads, sizeof(pthread_t))))
+    {
+        json_free(pool->finished);
+        json_free(pool->chunks);
+        json_free(pool);
+        return nd;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->ready_cond, NULL);
+
+    nd->pool = pool;
+
+    for (i = 0; i < opts.threads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, ndjson_worker, nd) != 0)
+        {
+            break;
+        }
+        pool->num_threads++;
+    }
+
+    if (pool->num_threads == 0)
+    {
+        // no threads to be had, fall back to reading the lines in place
+        ndjson_pool_destroy(pool);
+        nd->pool = NULL;
+    }
+
+    return nd;
+}
+
+/*
+ * Read the document on the next non blank line into record. A line that fails
+ * to parse is returned with its error and the following lines can still be
+ * read. Return false when there are no more lines
+ */
+bool json_ndjson_next(json_ndjson *nd, json_record *record)
+{
+    LOGFUNC();
+
+    if (!nd || !record)
+    {
+        return false;
+    }
+
+    if (nd->pool)
+    {
+        return ndjson_pool_next(nd, record);
+    }
+
+    return ndjson_read_line(nd, record);
+}
+
+/*
+ * Stop reading. Records not handed out yet are destroyed
+ */
+void json_ndjson_close(json_ndjson *nd)
+{
+    if (!nd)
+    {
+        return;
+    }
+
+    if (nd->pool)
+    {
+        ndjson_pool_destroy(nd->pool);
+    }
+    json_free(nd);
+}
+
+
+static bool ndjson_read_line(json_ndjson *nd, json_record *record)
+{
+    while (nd->pos < nd->len)
+    {
+        const char *start = nd->buf + nd->pos;
+        const char *eol = (const char *) memchr(start, '\n', nd->len - nd->pos);
+        size_t      line_len = eol ? (size_t) (eol - start) : nd->len - nd->pos;
+        size_t      line = nd->line++;
+
+        nd->pos += line_len + 1;
+
+        json_parser_init_buffer(&nd->parser, start, line_len);
+        record->root = json_parser_run(&nd->parser);
+
+        // blank lines separate nothing, skip them
+        if (nd->parser.error == JSON_ERROR_EMPTY_INPUT)
+        {
+            continue;
+        }
+
+        record->error = nd->parser.error;
+        record->error_loc = nd->parser.error ? nd->parser.buffer_idx : 0;
+        record->line = line;
+        return true;
+    }
+
+    return false;
+}
+
+
+/* ========== WORKER THREADS ========== */
+
+/*
+ * Workers first count the lines of every chunk, which is cheap, so that the
+ * reader knows the line numbers of chunks finishing in any order. They then
+ * parse the chunks while the reader is less than depth chunks behind.
+ */
+static void *ndjson_worker(void *arg)
+{
+    json_ndjson *nd = (json_ndjson *) arg;
+    ndjson_pool *pool = nd->pool;
+
+    json_use_allocator(pool->allocator);
+    pthread_mutex_lock(&pool->lock);
+
+    while (!pool->stop)
+    {
+        if (pool->next_count < pool->num_chunks)
+        {
+            ndjson_chunk *chunk = &pool->chunks[pool->next_count++];
+            const char   *p = nd->buf + chunk->start;
+            const char   *end = nd->buf + chunk->end;
+            size_t        lines = 0;
+
+            pthread_mutex_unlock(&pool->lock);
+            while ((p = (const char *) memchr(p, '\n', end - p)))
+            {
+                lines++;
+                p++;
+            }
+            pthread_mutex_lock(&pool->lock);
+
+            chunk->lines = lines;
+            if (++pool->counted == pool->num_chunks)
+            {
+                size_t i, base_line = 1;
+
+                for (i = 0; i < pool->num_chunks; i++)
+                {
+                    pool->chunks[i].base_line = base_line;
+                    base_line += pool->chunks[i].lines;
+                }
+                pthread_cond_broadcast(&pool->ready_cond);
+            }
+        }
+        else if (pool->next_parse < pool->num_chunks
+            && pool->next_parse < pool->consumed + pool->depth)
+        {
+            size_t        idx = pool->next_parse++;
+            ndjson_chunk *chunk = &pool->chunks[idx];
+
+            pthread_mutex_unlock(&pool->lock);
+            ndjson_chunk_parse(nd->buf, chunk);
+            pthread_mutex_lock(&pool->lock);
+
+            chunk->done = true;
+            pool->finished[pool->finished_tail++] = idx;
+            pthread_cond_broadcast(&pool->ready_cond);
+        }
+        else if (pool->next_parse == pool->num_chunks)
+        {
+            break;
+        }
+        else
+        {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+ * Parse the lines of chunk numbering them from 1
+ */
+static void ndjson_chunk_parse(const char *buf, ndjson_chunk *chunk)
+{
+    json_ndjson nd;
+    json_record record;
+
+    memset(&nd, 0, sizeof(json_ndjson));
+    nd.buf = buf + chunk->start;
+    nd.len = chunk->end - chunk->start;
+    nd.line = 1;
+
+    for (;;)
+    {
+        size_t pos = nd.pos;
+        size_t line = nd.line;
+
+        if (!ndjson_read_line(&nd, &record))
+            break;
+
+        if (chunk->cnt == chunk->alloced)
+        {
+            size_t       alloced = chunk->alloced ? 2 * chunk->alloced : 64;
+            json_record *records = (json_record *) json_realloc(chunk->records,
+                sizeof(json_record) * alloced);
+
+            if (!records)
+            {
+                // the reader parses the line again, and the rest, itself
+                json_destroy(record.root);
+                chunk->rest = chunk->start + pos;
+                chunk->rest_line = line;
+                return;
+            }
+            chunk->records = records;
+            chunk->alloced = alloced;
+        }
+        chunk->records[chunk->cnt++] = record;
+    }
+}
+
+/*
+ * Read the next of the lines of chunk no record could be kept for, see
+ * ndjson_chunk_parse
+ */
+static bool ndjson_chunk_read_rest(const char *buf, ndjson_chunk *chunk, json_record *record)
+{
+    json_ndjson nd;
+    bool        found;
+
+    memset(&nd, 0, sizeof(json_ndjson));
+    nd.buf = buf + chunk->rest;
+    nd.len = chunk->end - chunk->rest;
+    nd.line = chunk->rest_line;
+
+    found = ndjson_read_line(&nd, record);
+    // the last line may have no newline to step over
+    chunk->rest += nd.pos < nd.len ? nd.pos : nd.len;
+    chunk->rest_line = nd.line;
+
+    if (found)
+        record->line += chunk->base_line - 1;
+    return found;
+}
+
+/*
+ * Hand out the next record of the current chunk, waiting for the next chunk
+ * (the next in input order unless the pool is unordered) when it runs out
+ */
+static bool ndjson_pool_next(json_ndjson *nd, json_record *record)
+{
+    ndjson_pool  *pool = nd->pool;
+    ndjson_chunk *chunk = pool->current;
+
+    while (!chunk || pool->current_idx == chunk->cnt)
+    {
+        if (chunk && chunk->rest < chunk->end
+            && ndjson_chunk_read_rest(nd->buf, chunk, record))
+        {
+            return true;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (chunk)
+        {
+            ndjson_chunk_release(chunk, chunk->cnt);
+            pool->current = chunk = NULL;
+            pool->consumed++;
+            pthread_cond_broadcast(&pool->work_cond);
+        }
+
+        if (pool->consumed == pool->num_chunks)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return false;
+        }
+
+        if (pool->unordered)
+        {
+            while (pool->finished_head == pool->finished_tail
+                || pool->counted < pool->num_chunks)
+            {
+                pthread_cond_wait(&pool->ready_cond, &pool->lock);
+            }
+            chunk = &pool->chunks[pool->finished[pool->finished_head++]];
+        }
+        else
+        {
+            chunk = &pool->chunks[pool->consumed];
+            while (!chunk->done || pool->counted < pool->num_chunks)
+            {
+                pthread_cond_wait(&pool->ready_cond, &pool->lock);
+            }
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->current = chunk;
+        pool->current_idx = 0;
+    }
+
+    *record = chunk->records[pool->current_idx++];
+    record->line += chunk->base_line - 1;
+    return true;
+}
+
+/*
+ * Free the records array of chunk, destroying the documents that were not
+ * handed out to the reader
+ */
+static void ndjson_chunk_release(ndjson_chunk *chunk, size_t handed_out)
+{
+    size_t i;
+
+    for (i = handed_out; i < chunk->cnt; i++)
+    {
+        json_destroy(chunk->records[i].root);
+    }
+    json_free(chunk->records);
+    chunk->records = NULL;
+    chunk->cnt = 0;
+    chunk->alloced = 0;
+}
+
+static void ndjson_pool_destroy(ndjson_pool *pool)
+{
+    size_t i;
+    int    t;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (t = 0; t < pool->num_threads; t++)
+    {
+        pthread_join(pool->threads[t], NULL);
+    }
+
+    for (i = 0; i < pool->num_chunks; i++)
+    {
+        ndjson_chunk *chunk = &pool->chunks[i];
+        ndjson_chunk_release(chunk, chunk == pool->current ? pool->current_idx : 0);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->ready_cond);
+    json_free(pool->threads);
+    json_free(pool->finished);
+    json_free(pool->chunks);
+    json_free(pool);
+}
@@ -0,0 +1,349 @@
+/*
+ * Parallel parsing of a single large top level array
+ *
+ * A quick structural scan, which only follows strings and nesting, cuts the
+ * array at top level commas into slices of about chunk_size bytes. Worker
+ * threads parse the elements of the slices and the results are joined into one
+ * array. Anything unexpected, a malformed document included, is handed to the
+ * serial parser so that the output, errors and their locations, is always the
+ * one of a serial parse.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "parser.h"
+#include "iterator.h"
+#include "alloc.h"
+#include "utils.h"
+
+#define PARALLEL_DEFAULT_CHUNK_SIZE    (1 << 20)
+
+/* a run of elements parsed by one worker */
+typedef struct array_slice
+{
+    size_t   start; // first byte of the slice's first element
+    size_t   end;   // the comma or closing bracket after its last element
+    json   **elements;
+    size_t   cnt;
+    size_t   alloced;
+} array_slice;
+
+/* state shared by the worker threads */
+typedef struct array_job
+{
+    const char      *buf;
+    size_t           len;
+    array_slice     *slices;
+    size_t           num_slices;
+    size_t           next;   // next slice to parse
+    bool             failed; // a slice did not parse, the serial parser takes over
+    pthread_mutex_t  lock;
+    const json_allocator *allocator; // of the calling thread
+} array_job;
+
+static bool  array_split(array_job *job, size_t open, size_t chunk_size);
+static void *array_worker(void *arg);
+static bool  array_slice_parse(const array_job *job, array_slice *slice, bool last);
+static json_output *parse_serial(const char *buf, size_t len);
+
+
+/*
+ * Parse the len bytes of buf like json_parse does but, when the document is a
+ * large array, parse its elements on worker threads. options may be NULL,
+ * queue_depth and unordered are not used
+ */
+json_output *json_parse_parallel(const char *buf, size_t len,
+    const json_parallel_options *options)
+{
+    LOGFUNC();
+    json_parallel_options  opts = { 0, 0, 0, false };
+    json_parser            parser;
+    json_output           *output = NULL;
+    json                  *root = NULL;
+    array_job              job;
+    pthread_t             *threads = NULL;
+    int                    num_threads = 0;
+    size_t                 open, i;
+    size_t                 total = 0;
+
+    if (!buf)
+    {
+        return parse_serial(buf, len);
+    }
+
+    if (options)
+    {
+        opts = *options;
+    }
+    if (opts.threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.threads = cpus > 0 ? cpus : 1;
+    }
+    if (opts.chunk_size == 0)
+    {
+        opts.chunk_size = PARALLEL_DEFAULT_CHUNK_SIZE;
+    }
+
+    json_parser_init_buffer(&parser, buf, len);
+    if (opts.threads < 2 || json_peek(&parser) != '[')
+    {
+        return parse_serial(buf, len);
+    }
+    open = parser.buffer_idx;
+
+    memset(&job, 0, sizeof(array_job));
+    job.buf = buf;
+    job.len = len;
+    job.allocator = json_thread_allocator();
+
+    // a document that is not worth splitting or that the scan can't make
+    // sense of goes to the serial parser
+    if (!array_split(&job, open, opts.chunk_size) || job.num_slices < 2)
+    {
+        json_free(job.slices);
+        return parse_serial(buf, len);
+    }
+
+    // only whitespace may follow the array
+    parser.buffer_idx = job.slices[job.num_slices - 1].end + 1;
+    if (json_peek(&parser) != '\0' || parser.buffer_idx < parser.buffer_sz)
+    {
+        json_free(job.slices);
+        return parse_serial(buf, len);
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+
+    // the calling thread is one of the workers, the only one without memory for more
+    threads = (pthread_t *) json_calloc(opts.threads - 1, sizeof(pthread_t));
+    while (threads
+        && num_threads < opts.threads - 1
+        && (size_t) num_threads < job.num_slices - 1
+        && pthread_create(&threads[num_threads], NULL, array_worker, &job) == 0)
+    {
+        num_threads++;
+    }
+    array_worker(&job);
+
+    while (num_threads > 0)
+    {
+        pthread_join(threads[--num_threads], NULL);
+    }
+    json_free(threads);
+    pthread_mutex_destroy(&job.lock);
+
+    for (i = 0; i < job.num_slices; i++)
+    {
+        total += job.slices[i].cnt;
+    }
+
+    if (!job.failed
+        && (root = json_create(JSON_TYPE_ARRAY))
+        && (root->elements = (json **) json_malloc(sizeof(json *) * total))
+        && (output = (json_output *) json_calloc(1, sizeof(json_output))))
+    {
+        root->alloced = total;
+
+        for (i = 0; i < job.num_slices; i++)
+        {
+            memcpy(root->elements + root->cnt, job.slices[i].elements,
+                sizeof(json *) * job.slices[i].cnt);
+            root->cnt += job.slices[i].cnt;
+            json_free(job.slices[i].elements);
+        }
+
+        output->root = root;
+        output->error = JSON_ERROR_NONE;
+        output->buffer_idx = job.slices[job.num_slices - 1].end + 1;
+    }
+    else
+    {
+        // the serial parser reports what went wrong, running out of memory too
+        json_destroy(root);
+        for (i = 0; i < job.num_slices; i++)
+        {
+            while (job.slices[i].cnt > 0)
+            {
+                json_destroy(job.slices[i].elements[--job.slices[i].cnt]);
+            }
+            json_free(job.slices[i].elements);
+        }
+
+        output = parse_serial(buf, len);
+    }
+
+    json_free(job.slices);
+    return output;
+}
+
+
+/*
+ * Cut the array opened at index open into slices, at the first top level comma
+ * past every chunk_size bytes. Strings are skipped by their quotes and escapes
+ * and brackets only counted, checking them is left to the parser. Return false
+ * if the array is never closed or memory ran out
+ */
+static bool array_split(array_job *job, size_t open, size_t chunk_size)
+{
+    const unsigned char *buf = (const unsigned char *) job->buf;
+    size_t               start = open + 1;
+    size_t               i;
+    int                  depth = 1;
+
+    for (i = open + 1; i < job->len; i++)
+    {
+        switch (buf[i])
+        {
+            case '"':
+                // a backslash escapes the next byte, which can't end a string
+                while (++i < job->len && buf[i] != '"')
+                {
+                    if (buf[i] == '\\')
+                        i++;
+                }
+                break;
+            case '[': case '{':
+                depth++;
+                break;
+            case ']': case '}':
+                // the array is closed when depth drops to 0
+                if (--depth > 0)
+                    break;
+                // fall through
+            case ',':
+                if (depth > 1 || (depth == 1 && i - start < chunk_size))
+                    break;
+
+                if (job->num_slices % 64 == 0)
+                {
+                    array_slice *slices = (array_slice *) json_realloc(job->slices,
+                        sizeof(array_slice) * (job->num_slices + 64));
+
+                    if (!slices)
+                        return false;
+                    job->slices = slices;
+                }
+                memset(&job->slices[job->num_slices], 0, sizeof(array_slice));
+                job->slices[job->num_slices].start = start;
+                job->slices[job->num_slices].end = i;
+                job->num_slices++;
+                start = i + 1;
+
+                if (depth == 0)
+                    return true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Parse slices until none are left or one of them fails
+ */
+static void *array_worker(void *arg)
+{
+    array_job *job = (array_job *) arg;
+
+    json_use_allocator(job->allocator);
+    pthread_mutex_lock(&job->lock);
+
+    while (!job->failed && job->next < job->num_slices)
+    {
+        size_t idx = job->next++;
+        bool   ok;
+
+        pthread_mutex_unlock(&job->lock);
+        ok = array_slice_parse(job, &job->slices[idx], idx == job->num_slices - 1);
+        pthread_mutex_lock(&job->lock);
+
+        if (!ok)
+            job->failed = true;
+    }
+
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/*
+ * Parse the elements of slice as the array parser would, at depth 1. They
+ * have to end exactly at the slice's end, on a comma or, for the last slice,
+ * on the closing bracket
+ */
+static bool array_slice_parse(const array_job *job, array_slice *slice, bool last)
+{
+    json_parser  parser;
+    json        *value;
+    int32_t      c;
+
+    json_parser_init_buffer(&parser, job->buf, job->len);
+    parser.buffer_idx = slice->start;
+    parser.depth = 1;
+
+    for (;;)
+    {
+        if (!(value = json_parser_parse_value(&parser)))
+        {
+            return false;
+        }
+
+        if (slice->cnt == slice->alloced)
+        {
+            size_t  alloced = slice->alloced ? 2 * slice->alloced : 64;
+            json  **elements = (json **) json_realloc(slice->elements,
+                sizeof(json *) * alloced);
+
+            if (!elements)
+            {
+                json_destroy(value);
+                return false;
+            }
+            slice->elements = elements;
+            slice->alloced = alloced;
+        }
+        slice->elements[slice->cnt++] = value;
+
+        c = json_next(&parser);
+        if (parser.buffer_idx == slice->end + 1)
+        {
+            return c == (last ? ']' : ',');
+        }
+        if (c != ',' || parser.buffer_idx > slice->end)
+        {
+            return false;
+        }
+    }
+}
+
+/*
+ * Parse the whole buffer on the calling thread
+ */
+static json_output *parse_serial(const char *buf, size_t len)
+{
+    json_parser  parser;
+    json_output *output = (json_output *) json_calloc(1, sizeof(json_output));
+
+    if (!output)
+    {
+        return NULL;
+    }
+
+    if (!buf)
+    {
+        output->error = JSON_ERROR_EMPTY_INPUT;
+        return output;
+    }
+
+    json_parser_init_buffer(&parser, buf, len);
+    output->root = json_parser_run(&parser);
+    output->error = parser.error;
+    output->buffer_idx = parser.buffer_idx;
+    return output;
+}
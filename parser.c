@@ -20,10 +20,12 @@ value = string | number | object | array | true | false | null
 #include <ctype.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #include "json.h"
 #include "parser.h"
 #include "iterator.h"
+#include "alloc.h"
 #include "utils.h"
 
 
@@ -32,17 +34,44 @@ value = string | number | object | array | true | false | null
 static json *parse_object(json_parser *);
 static json *parse_array(json_parser *);
 static json *parse_string(json_parser *);
+static json *parse_trusted_string(json_parser *);
 static json *parse_number(json_parser *);
+static bool  parse_number_value(json_parser *, double *);
 static json *parse_boolean(json_parser *, bool);
 static json *parse_null(json_parser *);
 static obj_pair *parse_pair(json_parser *);
 static unsigned char *parse_object_key(json_parser *);
 static json *parse_value(json_parser *);
+static json *parse_root(json_parser *);
+static json *parse_selected_value(json_parser *, const json_select_node *);
+static bool  parse_selected_key(json_parser *, unsigned char **, const json_select_node **);
+static json *parse_probed_value(json_parser *);
+static json *parse_filtered_value(json_parser *);
+static bool  filter_matches(json_parser *, const json_filter *, const json_probe *);
+static int   escaped_string_cmp(json_parser *, const json_probe *, const char *);
+
+static json_select_node *select_compile(const char *const *paths, size_t n);
+static json_select_node *select_add_child(json_select_node *node, const char *name, size_t len);
+static bool  select_merge(json_select_node *dst, const json_select_node *src);
+static bool  select_normalize(json_select_node *node);
+static void  select_destroy(json_select_node *node);
+static const json_select_node *select_child(const json_select_node *node, 
+    const unsigned char *name, size_t len);
+static const json_select_node *select_child_at(const json_select_node *node, size_t idx);
 
 static void  json_parser_init(json_parser *parser, const char *json_string);
 static void  json_parser_destroy(json_parser *);
 static json_output *json_output_new();
-static void  arr_realloc(json *);
+static json *node_create(json_parser *, json_type);
+static void  node_destroy(json_parser *, json *);
+static obj_pair *pair_create(json_parser *);
+static bool  mem_charge(json_parser *, size_t);
+static bool  buffer_resize(json_parser *, json *, size_t, size_t);
+static bool  string_reserve(json_parser *, json *, size_t);
+static void  count_sizes(json_parser *, size_t);
+static bool  reserve_exact(json_parser *, json *);
+static bool  arr_realloc(json_parser *, json *);
+static bool  array_unpack(json_parser *, json *);
 void         json_output_destroy(json_output *jo);
 
 static int32_t escaped_chars2actual(json_parser *parser);
@@ -55,6 +84,8 @@ static int32_t char2hex(int32_t c);
 
 #define CHAR2NUM(c)              ((c) - '0')
 #define IS_CONTROL_CHAR(c)       ((c) < 32)
+#define IS_NUMBER_START(c)       ((c) == '-' || isdigit(c))
+#define SLOT_SIZE(js)            (((js)->flags & JSON_PACKED) ? sizeof(double) : sizeof(void *))
 
 /*
  The macro sets the error if it has not been set. In some cases we just set a 
@@ -62,6 +93,15 @@ static int32_t char2hex(int32_t c);
 */
 #define SET_PARSER_ERROR(p, e)   p->error = p->error ? p->error : e
 
+/*
+ When the parser only validates its input the parse_* functions return these in
+ place of a value, so that NULL keeps meaning failure. They are never handed out.
+*/
+static json     validated_value;
+static obj_pair validated_pair;
+#define VALIDATED_VALUE          (&validated_value)
+#define VALIDATED_PAIR           (&validated_pair)
+
 
 static int32_t char2hex(int32_t c)
 {
@@ -175,14 +215,19 @@ static json *parse_value(json_parser *parser)
 
     json    *value = NULL;
     int32_t  c = json_peek(parser);
+    bool     materialize = parser->materialize;
 
-    parser->depth++;
-    if (parser->depth > JSON_PARSER_MAX_DEPTH)
+    // trusted input is not nested too deeply, but filters still need the depth
+    if (++parser->depth > JSON_PARSER_MAX_DEPTH && !parser->trusted)
     {
         SET_PARSER_ERROR(parser, JSON_ERROR_PARSER_MAX_DEPTH_EXCEEDED);
         return NULL;
     }
 
+    // only whole values are selected, so scalars on the way are just validated
+    if (parser->select && c != '{' && c != '[')
+        parser->materialize = false;
+
     switch (c)
     {
         case '{':
@@ -214,10 +259,243 @@ static json *parse_value(json_parser *parser)
             break;      
     }
 
+    parser->materialize = materialize;
     parser->depth--;
     return value;
 }
 
+/*
+ * Parse a value reached while parsing selected paths. Values off the paths are
+ * only validated and values at the end of a path are built whole
+ */
+static json *parse_selected_value(json_parser *parser, const json_select_node *select)
+{
+    const json_select_node *parent = parser->select;
+    bool                    materialize = parser->materialize;
+    json                   *value = NULL;
+
+    if (select && select->terminal && parser->probe)
+        return parse_probed_value(parser);
+
+    if (!select)
+        parser->materialize = false;
+    parser->select = (select && !select->terminal) ? select : NULL;
+
+    value = parse_value(parser);
+
+    parser->select = parent;
+    parser->materialize = materialize;
+    return value;
+}
+
+/*
+ * Validate the value at the filtered path and note down in parser->probe what
+ * filter_matches needs to compare it, without building anything
+ */
+static json *parse_probed_value(json_parser *parser)
+{
+    LOGFUNC();
+    json_probe             *probe = parser->probe;
+    const json_select_node *select = parser->select;
+    json                   *value = NULL;
+    int32_t                 c = json_peek(parser);
+    size_t                  start = parser->buffer_idx;
+
+    parser->probe = NULL;
+    parser->select = NULL;
+    value = parse_value(parser);
+    parser->select = select;
+    parser->probe = probe;
+
+    if (!value)
+        return NULL;
+
+    switch (c)
+    {
+        case '{':
+            probe->type = JSON_TYPE_OBJECT;
+            break;
+        case '[':
+            probe->type = JSON_TYPE_ARRAY;
+            break;
+        case '"':
+            probe->type = JSON_TYPE_STRING;
+            probe->str_start = start;
+            probe->str_len = parser->buffer_idx - start - 2;
+            break;
+        case 't':
+        case 'f':
+            probe->type = JSON_TYPE_BOOLEAN;
+            probe->bool_val = (c == 't');
+            break;
+        case 'n':
+            probe->type = JSON_TYPE_NULL;
+            break;
+        default:
+        {
+            // the number is valid, read it again for its value
+            size_t end = parser->buffer_idx;
+
+            probe->type = JSON_TYPE_NUMBER;
+            parser->buffer_idx = start;
+            parse_number_value(parser, &probe->num_val);
+            parser->buffer_idx = end;
+            break;
+        }
+    }
+
+    return value;
+}
+
+/*
+ * Parse a record of the filtered array. The record is first scanned for the
+ * filtered field without building anything and only built if the field matches
+ */
+static json *parse_filtered_value(json_parser *parser)
+{
+    LOGFUNC();
+    json_probe  probe = { .type = JSON_TYPE_NONE };
+    bool        materialize = parser->materialize;
+    json       *value = NULL;
+    size_t      start;
+
+    json_peek(parser); // move to the start of the record
+    start = parser->buffer_idx;
+
+    parser->materialize = false;
+    parser->probe = &probe;
+    value = parse_selected_value(parser, parser->filter_path);
+    parser->probe = NULL;
+    parser->materialize = materialize;
+
+    if (!value)
+        return NULL;
+
+    if (!materialize || !filter_matches(parser, parser->filter, &probe))
+        return VALIDATED_VALUE;
+
+    parser->buffer_idx = start;
+    return parse_value(parser);
+}
+
+/*
+ * Return true if the probed value satisfies the filter. Values of another type
+ * than the filter's never match
+ */
+static bool filter_matches(json_parser *parser, const json_filter *filter, 
+    const json_probe *probe)
+{
+    int cmp = 0;
+
+    if (probe->type != filter->type)
+        return false;
+
+    switch (probe->type)
+    {
+        case JSON_TYPE_NUMBER:
+            if (isnan(probe->num_val) || isnan(filter->num_val))
+                return filter->op == JSON_FILTER_NE;
+            cmp = (probe->num_val > filter->num_val) - (probe->num_val < filter->num_val);
+            break;
+        case JSON_TYPE_BOOLEAN:
+            cmp = (int) probe->bool_val - (int) filter->bool_val;
+            break;
+        case JSON_TYPE_NULL:
+            cmp = 0;
+            break;
+        case JSON_TYPE_STRING:
+        {
+            const unsigned char *raw = parser->buffer + probe->str_start + 1;
+            size_t               len = probe->str_len;
+
+            if (!filter->string_val)
+                return false;
+
+            if (!memchr(raw, '\\', len))
+            {
+                size_t filter_len = strlen(filter->string_val);
+
+                cmp = memcmp(raw, filter->string_val, len < filter_len ? len : filter_len);
+                if (cmp == 0)
+                    cmp = (len > filter_len) - (len < filter_len);
+            }
+            else
+            {
+                cmp = escaped_string_cmp(parser, probe, filter->string_val);
+            }
+            break;
+        }
+        default: // objects and arrays are not compared
+            return false;
+    }
+
+    switch (filter->op)
+    {
+        case JSON_FILTER_EQ:
+            return cmp == 0;
+        case JSON_FILTER_NE:
+            return cmp != 0;
+        case JSON_FILTER_LT:
+            return cmp < 0;
+        case JSON_FILTER_LE:
+            return cmp <= 0;
+        case JSON_FILTER_GT:
+            return cmp > 0;
+        case JSON_FILTER_GE:
+            return cmp >= 0;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Compare the escaped string the probe found with str like strcmp does. Each
+ * escape is decoded into a scratch buffer on the stack as the comparison gets
+ * to it, so nothing is built or charged to the parse. The probe has already
+ * checked the string
+ */
+static int escaped_string_cmp(json_parser *parser, const json_probe *probe, const char *str)
+{
+    const unsigned char *other = (const unsigned char *) str;
+    size_t               idx = probe->str_start + 1;
+    size_t               end = idx + probe->str_len;
+    size_t               buffer_idx = parser->buffer_idx;
+    bool                 skip_space = parser->skip_space;
+    int                  cmp = 0;
+
+    parser->skip_space = false;
+    while (cmp == 0 && idx < end)
+    {
+        unsigned char scratch[BYTES_PER_UNICODE_CHAR];
+        size_t        len = 1;
+        size_t        i;
+
+        if (parser->buffer[idx] != '\\')
+        {
+            scratch[0] = parser->buffer[idx++];
+        }
+        else
+        {
+            int32_t c;
+
+            parser->buffer_idx = idx + 1;
+            if ((c = escaped_chars2actual(parser)) < 0)
+                break;
+            len = utf8encode(c, scratch);
+            idx = parser->buffer_idx;
+        }
+
+        for (i = 0; cmp == 0 && i < len; i++, other++)
+            cmp = *other ? (int) scratch[i] - (int) *other : 1;
+    }
+    parser->skip_space = skip_space;
+    parser->buffer_idx = buffer_idx;
+
+    if (cmp == 0 && *other)
+        cmp = -1;
+    return cmp;
+}
+
 
 /*
  * Parse a null value
@@ -229,7 +507,10 @@ static json *parse_null(json_parser *parser)
     LOGFUNC();
     if (is_string_matched(parser, (unsigned char *) "null"))
     {
-        json *null_obj = json_create(JSON_TYPE_NULL);
+        if (!parser->materialize)
+            return VALIDATED_VALUE;
+
+        json *null_obj = node_create(parser, JSON_TYPE_NULL);
         return null_obj;
     }
 
@@ -251,7 +532,11 @@ static json *parse_boolean(json_parser *parser, bool bool_val)
     json *bool_obj = NULL;
     if (is_string_matched(parser, (unsigned char *)bool_str))
     {
-        bool_obj = json_create(JSON_TYPE_BOOLEAN);
+        if (!parser->materialize)
+            return VALIDATED_VALUE;
+
+        if (!(bool_obj = node_create(parser, JSON_TYPE_BOOLEAN)))
+            return NULL;
         bool_obj->bool_val = bool_val;
         return bool_obj;
     }
@@ -280,6 +565,27 @@ static json *parse_boolean(json_parser *parser, bool bool_val)
  * [<E/e_symbol> [<sign_part>] <exponent_part>]
  */
 static json *parse_number(json_parser *parser)
+{
+    LOGFUNC();
+    double  num_value = 0;
+    json   *number = NULL;
+
+    if (!parse_number_value(parser, &num_value))
+        return NULL;
+
+    if (!parser->materialize)
+        return VALIDATED_VALUE;
+
+    if (!(number = node_create(parser, JSON_TYPE_NUMBER)))
+        return NULL;
+    number->num_val = num_value;
+    return number;
+}
+
+/*
+ * Parse a number (see parse_number) into number
+ */
+static bool parse_number_value(json_parser *parser, double *number)
 {
     LOGFUNC();
     int32_t c;
@@ -287,7 +593,6 @@ static json *parse_number(json_parser *parser)
     int     exp_sign = 1;
     double  num_value = 0;
     double  exponent = 0;
-    json   *number = json_create(JSON_TYPE_NUMBER);
 
     /* process sign of number */
     if (json_peek(parser) == '-')
@@ -375,13 +680,13 @@ static json *parse_number(json_parser *parser)
     }
 
     parser->skip_space = true;
+
     /* now wrap up everything */
-    number->num_val = num_value * base_sign * pow(10, exp_sign * exponent);
-    return number;
+    *number = num_value * base_sign * pow(10, exp_sign * exponent);
+    return true;
 
 ERROR:
-    json_destroy(number);
-    return NULL;
+    return false;
 }
 
 
@@ -404,13 +709,15 @@ static json *parse_string(json_parser *parser)
     {
         int32_t c;
 
+        if (parser->trusted && !parser->source)
+            return parse_trusted_string(parser);
+
         parser->skip_space = false;
-        string = json_create(JSON_TYPE_STRING);
+        if (parser->materialize && !(string = node_create(parser, JSON_TYPE_STRING)))
+            goto ERROR;
 
         while ((c = json_next(parser)) != '"' && c != -1 && !IS_CONTROL_CHAR(c))
         {
-            arr_realloc(string);
-
             if (c == '\\')
             {
                 if ((c = escaped_chars2actual(parser)) < 0)
@@ -420,7 +727,12 @@ static json *parse_string(json_parser *parser)
                 }
             }
 
-            string->cnt += utf8encode(c, string->string_val + string->cnt);
+            if (string)
+            {
+                if (!arr_realloc(parser, string))
+                    goto ERROR;
+                string->cnt += utf8encode(c, string->string_val + string->cnt);
+            }
         }
 
         if (c != '"')
@@ -436,8 +748,12 @@ static json *parse_string(json_parser *parser)
             goto ERROR;
         }
         
-        string->string_val[string->cnt] = '\0';
         parser->skip_space = true;
+
+        if (!string)
+            return VALIDATED_VALUE;
+
+        string->string_val[string->cnt] = '\0';
         return string;
     }
     else 
@@ -450,6 +766,82 @@ ERROR:
     return NULL;
 }
 
+/*
+ * parse_string for trusted input, from after the opening quote. The bytes up to
+ * the next quote or backslash are copied as they are, neither decoded as UTF-8
+ * nor checked for control characters. Escapes and the end of the buffer are
+ * handled like in parse_string
+ */
+static json *parse_trusted_string(json_parser *parser)
+{
+    LOGFUNC();
+    json    *string = NULL;
+    int32_t  c;
+
+    parser->skip_space = false;
+    if (parser->materialize && !(string = node_create(parser, JSON_TYPE_STRING)))
+        goto ERROR;
+
+    for (;;)
+    {
+        const unsigned char *start = parser->buffer + parser->buffer_idx;
+        const unsigned char *end = parser->buffer + parser->buffer_sz;
+        const unsigned char *p = start;
+        size_t               run;
+
+        while (p < end && *p != '"' && *p != '\\')
+            p++;
+        run = p - start;
+
+        if (string && run > 0)
+        {
+            if (!string_reserve(parser, string, string->cnt + run + BYTES_PER_UNICODE_CHAR + 1))
+                goto ERROR;
+            memcpy(string->string_val + string->cnt, start, run);
+            string->cnt += run;
+        }
+        parser->buffer_idx += run;
+
+        if ((c = json_next(parser)) == '"')
+        {
+            break;
+        }
+        else if (c == '\\')
+        {
+            if ((c = escaped_chars2actual(parser)) < 0)
+            {
+                SET_PARSER_ERROR(parser, JSON_ERROR_INVALID_JSON);
+                goto ERROR;
+            }
+
+            if (string)
+            {
+                if (!arr_realloc(parser, string))
+                    goto ERROR;
+                string->cnt += utf8encode(c, string->string_val + string->cnt);
+            }
+        }
+        else
+        {
+            // the input was cut short
+            SET_PARSER_ERROR(parser, JSON_ERROR_UNBALANCED_QUOTE);
+            goto ERROR;
+        }
+    }
+
+    parser->skip_space = true;
+
+    if (!string)
+        return VALIDATED_VALUE;
+
+    string->string_val[string->cnt] = '\0';
+    return string;
+
+ERROR:
+    json_destroy(string);
+    return NULL;
+}
+
 
 /*
  * parser an array
@@ -464,13 +856,20 @@ static json *parse_array(json_parser *parser)
     {
         json    *value = NULL;
         int32_t  c;
+        size_t   idx = 0;
 
-        array = json_create(JSON_TYPE_ARRAY);
+        if (parser->materialize && !(array = node_create(parser, JSON_TYPE_ARRAY)))
+            goto ERROR;
+        // an array starting with a number stays packed until something else comes
+        if (array && parser->pack_numbers && IS_NUMBER_START(json_peek(parser)))
+            array->flags |= JSON_PACKED;
+        if (parser->sizes && !reserve_exact(parser, array))
+            goto ERROR;
 
         if (json_peek(parser) == ']')
         {
             json_next(parser);
-            return array;
+            return array ? array : VALIDATED_VALUE;
         }
 
         if (json_peek(parser) == '\0')
@@ -480,15 +879,43 @@ static json *parse_array(json_parser *parser)
         }
 
         do {
-            arr_realloc(array);
+            // room is made first, so that a value is never left without a place
+            if (array && !arr_realloc(parser, array))
+                goto ERROR;
+
+            if (array && (array->flags & JSON_PACKED))
+            {
+                if (IS_NUMBER_START(json_peek(parser)))
+                {
+                    if (!parse_number_value(parser, &array->numbers[array->cnt]))
+                    {
+                        SET_PARSER_ERROR(parser, JSON_ERROR_INVALID_JSON);
+                        goto ERROR;
+                    }
+                    array->cnt++;
+                    continue;
+                }
+                if (!array_unpack(parser, array))
+                    goto ERROR;
+            }
+
+            if (parser->filter && parser->depth == 1)
+                value = parse_filtered_value(parser);
+            else if (parser->select)
+                value = parse_selected_value(parser, select_child_at(parser->select, idx++));
+            else
+                value = parse_value(parser);
 
-            if (!(value = parse_value(parser)))
+            if (!value)
             {
                 SET_PARSER_ERROR(parser, JSON_ERROR_INVALID_JSON);
                 goto ERROR;
             }
 
-            array->elements[array->cnt++] = value;
+            if (array && value != VALIDATED_VALUE)
+            {
+                array->elements[array->cnt++] = value;
+            }
         } while ((c = json_next(parser)) == ',');
 
         if (c != ']')
@@ -497,7 +924,7 @@ static json *parse_array(json_parser *parser)
             goto ERROR;
         }
         
-        return array;
+        return array ? array : VALIDATED_VALUE;
     }
     else
     {
@@ -518,13 +945,79 @@ static unsigned char *parse_object_key(json_parser *parser)
 
     if (string)
     {
-        key = (unsigned char *) strdup((char *) string->string_val);
+        // the key takes over the string's buffer
+        key = string->string_val;
+        string->string_val = NULL;
+        node_destroy(parser, string);
     }
 
-    json_destroy(string);
     return key;
 }
 
+/*
+ * Parse an object key while parsing selected paths and find the path node the
+ * member leads to. The key is only copied if the member is going to be built.
+ */
+static bool parse_selected_key(json_parser *parser, unsigned char **key,
+    const json_select_node **select)
+{
+    LOGFUNC();
+    const unsigned char *raw = NULL;
+    size_t               raw_len = 0;
+    size_t               start;
+    bool                 materialize = parser->materialize;
+
+    json_peek(parser); // move to the opening quote
+    start = parser->buffer_idx;
+
+    parser->materialize = false;
+    if (!parse_string(parser))
+    {
+        parser->materialize = materialize;
+        return false;
+    }
+    parser->materialize = materialize;
+
+    // the key has been validated so without escapes its bytes are the key
+    raw = parser->buffer + start + 1;
+    raw_len = parser->buffer_idx - start - 2;
+
+    if (!memchr(raw, '\\', raw_len))
+    {
+        *select = select_child(parser->select, raw, raw_len);
+
+        if (*select && materialize)
+        {
+            if (!(*key = (unsigned char *) json_malloc(raw_len + 1)))
+            {
+                SET_PARSER_ERROR(parser, JSON_ERROR_MEMORY);
+                return false;
+            }
+            memcpy(*key, raw, raw_len);
+            (*key)[raw_len] = '\0';
+        }
+        return true;
+    }
+
+    // escaped keys have to be decoded before they can be compared
+    parser->buffer_idx = start;
+    parser->materialize = true;
+    *key = parse_object_key(parser);
+    parser->materialize = materialize;
+
+    if (!*key)
+        return false;
+
+    *select = select_child(parser->select, *key, strlen((char *) *key));
+
+    if (!*select || !materialize)
+    {
+        json_free(*key);
+        *key = NULL;
+    }
+    return true;
+}
+
 /*
  * parse an object pair
  * grammar:
@@ -536,20 +1029,46 @@ static obj_pair *parse_pair(json_parser *parser)
     obj_pair *pair = NULL;
     json     *value = NULL;
     unsigned char *key = NULL;
+    const json_select_node *select = NULL;
 
-    pair = (obj_pair *) calloc(1, sizeof(obj_pair));
-
-    if (!(key = parse_object_key(parser)))
+    if (parser->select)
+    {
+        if (!parse_selected_key(parser, &key, &select))
+            goto ERROR;
+    }
+    else if (parser->materialize)
+    {
+        if (!(key = parse_object_key(parser)))
+            goto ERROR;
+    }
+    else if (!parse_string(parser))
+    {
         goto ERROR;
+    }
 
     if (json_next(parser) == ':')
     {
-        if (!(value = parse_value(parser)))
+        value = parser->select
+            ? parse_selected_value(parser, select)
+            : parse_value(parser);
+
+        if (!value)
         {
             SET_PARSER_ERROR(parser, JSON_ERROR_INVALID_JSON);
             goto ERROR;
         }
 
+        if (!key || value == VALIDATED_VALUE)
+        {
+            json_free(key);
+            return VALIDATED_PAIR;
+        }
+
+        if (!(pair = pair_create(parser)))
+        {
+            node_destroy(parser, value);
+            goto ERROR;
+        }
         pair->key = key;
         pair->value = value;
 
@@ -561,9 +1080,7 @@ static obj_pair *parse_pair(json_parser *parser)
     }   
 
 ERROR:
-    free(pair);
-    free(key);
-    json_destroy(value);
+    json_free(key);
     return NULL;
 }
 
@@ -582,16 +1099,20 @@ static json *parse_object(json_parser *parser)
         obj_pair *pair = NULL;
         int32_t   c;
 
-        object = json_create(JSON_TYPE_OBJECT);
+        if (parser->materialize && !(object = node_create(parser, JSON_TYPE_OBJECT)))
+            goto ERROR;
+        if (parser->sizes && !reserve_exact(parser, object))
+            goto ERROR;
 
         if (json_peek(parser) == '}')
         {
             json_next(parser);
-            return object;
+            return object ? object : VALIDATED_VALUE;
         }
 
         do {
-            arr_realloc(object);
+            if (object && !arr_realloc(parser, object))
+                goto ERROR;
 
             if (!(pair = parse_pair(parser)))
             {
@@ -599,7 +1120,10 @@ static json *parse_object(json_parser *parser)
                 goto ERROR;
             }
 
-            object->members[object->cnt++] = pair;
+            if (object && pair != VALIDATED_PAIR)
+            {
+                object->members[object->cnt++] = pair;
+            }
         } while ((c = json_next(parser)) == ',');
 
         if (c != '}')
@@ -608,7 +1132,7 @@ static json *parse_object(json_parser *parser)
             goto ERROR;
         }
 
-        return object;
+        return object ? object : VALIDATED_VALUE;
     }
     else
     {
@@ -620,6 +1144,49 @@ ERROR:
     return NULL;
 }
 
+/*
+ * Parse the whole buffer as one JSON text. On error the error is set in the
+ * parser, buffer_idx is left at the error location and NULL is returned
+ */
+static json *parse_root(json_parser *parser)
+{
+    LOGFUNC();
+    json  *root = NULL;
+    size_t end_idx;
+
+    // error on 'empty' input since it's not valid JSON
+    if (json_peek(parser) == '\0')
+    {
+        SET_PARSER_ERROR(parser, JSON_ERROR_EMPTY_INPUT);
+        parser->buffer_idx = 0;
+        return NULL;
+    }
+
+    root = parse_value(parser);
+    end_idx = parser->buffer_idx;
+
+    // unhandled error cases e.g trailing input
+    if (parser->error == JSON_ERROR_NONE)
+    {
+        if (!root
+            || json_peek(parser) != '\0'
+            || parser->buffer_idx < parser->buffer_sz)
+        {
+            SET_PARSER_ERROR(parser, JSON_ERROR_INVALID_JSON);
+        }
+        parser->buffer_idx = end_idx;
+    }
+
+    if (parser->error != JSON_ERROR_NONE)
+    {
+        if (root != VALIDATED_VALUE)
+            json_destroy(root);
+        root = NULL;
+    }
+
+    return root;
+}
+
 /*
 * Parse json_string to a json tree
 * GRAMMAR: json := object | array
@@ -630,7 +1197,8 @@ json_output *json_parse(const char *json_string)
     json_parser   parser;
     json_output  *output;
 
-    output = json_output_new();
+    if (!(output = json_output_new()))
+        return NULL;
 
     // error on null string since it's not valid JSON
     if (!json_string)
@@ -640,45 +1208,269 @@ json_output *json_parse(const char *json_string)
     }
 
     json_parser_init(&parser, json_string);
-
-    // error on 'empty' input since it's not valid JSON
-    if (json_peek(&parser) == '\0')
+    if (!parser.buffer)
     {
-        output->error = JSON_ERROR_EMPTY_INPUT;
+        output->error = JSON_ERROR_MEMORY;
         return output;
     }
 
-    output->root = parse_value(&parser);
+    output->root = parse_root(&parser);
     output->error = parser.error;
     output->buffer_idx = parser.buffer_idx;
 
-    // unhandled error cases
-    if (output->error == JSON_ERROR_NONE)
+    json_parser_destroy(&parser);
+    return output;
+}
+
+/*
+ * Check that the len bytes of buf are valid JSON without building a tree, so
+ * nothing is allocated. error and error_loc (both optional) get what json_parse
+ * would report for the same input. Return true if the input is valid
+ */
+bool json_validate(const char *buf, size_t len, int *error, size_t *error_loc)
+{
+    LOGFUNC();
+    json_parser parser;
+
+    if (!buf)
     {
-        if (json_peek(&parser) != '\0' || !output->root)
-        {
-            json_destroy(output->root);
-            output->root = NULL;
-            output->error = JSON_ERROR_INVALID_JSON;
-        }
+        parser.error = JSON_ERROR_EMPTY_INPUT;
+        parser.buffer_idx = 0;
     }
     else
     {
-        json_destroy(output->root);
+        json_parser_init_buffer(&parser, buf, len);
+        parser.materialize = false;
+        parse_root(&parser);
+    }
+
+    if (error)
+        *error = parser.error;
+    if (error_loc)
+        *error_loc = parser.error ? parser.buffer_idx : 0;
+
+    return parser.error == JSON_ERROR_NONE;
+}
+
+/*
+ * Parse the len bytes of buf, which is not copied and needs no terminating NUL.
+ * options may be NULL. With JSON_PARSE_TRUSTED the input is taken to be valid,
+ * such as the output of json2string: strings are copied without checking their
+ * UTF-8 encoding or looking for control characters and the nesting depth is not
+ * limited. Input cut short is still reported as an error. With
+ * JSON_PARSE_EXACT_SIZE the members of arrays and objects are counted a few
+ * kilobytes ahead of the parser, and those that close within that window are
+ * allocated once at their final size. With
+ * JSON_PARSE_PACK_NUMBERS, off by default, arrays of numbers only are kept as
+ * a double[], whose numbers json_array_get does not hand out as values until
+ * the array is unpacked, see json_array_get. The output and the tree come from
+ * options->allocator if it is set, see json_use_allocator.
+ * A tree that would take more than options->max_bytes fails with
+ * JSON_ERROR_MEMORY_LIMIT, and one that can't be allocated with
+ * JSON_ERROR_MEMORY. NULL is returned if not even the output can be
+ */
+json_output *json_parse_ex(const char *buf, size_t len, const json_parse_options *options)
+{
+    LOGFUNC();
+    json_parser           parser;
+    json_output          *output;
+    const json_allocator *allocator = json_thread_allocator();
+
+    if (options && options->allocator)
+        json_use_allocator(options->allocator);
+
+    output = json_output_new();
+
+    if (!output)
+    {
+        // nothing more to report
+    }
+    else if (!buf)
+    {
+        output->error = JSON_ERROR_EMPTY_INPUT;
+    }
+    else
+    {
+        json_parser_init_buffer(&parser, buf, len);
+
+        output->root = json_parser_run_ex(&parser, options);
+        output->error = parser.error;
+        output->buffer_idx = parser.buffer_idx;
+    }
+
+    json_use_allocator(allocator);
+    return output;
+}
+
+/*
+ * Parse the len bytes of buf keeping only the values at the given paths.
+ * Paths look like "/meta/id": a "*" component matches any key or array index
+ * and a number also matches that array index. The containers on the way to a
+ * selected value are kept even if nothing in them matches, and everything else
+ * is validated without being built. The empty path "" selects the whole document
+ */
+json_output *json_parse_select(const char *buf, size_t len, const char *const *paths, size_t n)
+{
+    LOGFUNC();
+    json_parser       parser;
+    json_output      *output;
+    json_select_node *select;
+
+    if (!(output = json_output_new()))
+        return NULL;
+
+    if (!buf)
+    {
+        output->error = JSON_ERROR_EMPTY_INPUT;
+        return output;
+    }
+
+    if (!(select = select_compile(paths, n)))
+    {
+        output->error = JSON_ERROR_MEMORY;
+        return output;
+    }
+
+    json_parser_init_buffer(&parser, buf, len);
+    parser.select = select->terminal ? NULL : select;
+
+    output->root = parse_root(&parser);
+    output->error = parser.error;
+    output->buffer_idx = parser.buffer_idx;
+
+    // a scalar document with no path selecting it
+    if (output->root == VALIDATED_VALUE)
         output->root = NULL;
+
+    select_destroy(select);
+    return output;
+}
+
+/*
+ * Parse the len bytes of buf, an array of records, keeping only the records
+ * whose field at filter->path (a path as in json_parse_select, "" for the
+ * record itself) compares to the filter's value as filter->op says. The other
+ * records are validated without being built. Records that lack the field or
+ * where it has another type than the filter's value never match
+ */
+json_output *json_parse_filter(const char *buf, size_t len, const json_filter *filter)
+{
+    LOGFUNC();
+    json_parser       parser;
+    json_output      *output;
+    json_select_node *filter_path;
+    int32_t           c;
+
+    if (!(output = json_output_new()))
+        return NULL;
+
+    if (!buf || !filter)
+    {
+        output->error = JSON_ERROR_EMPTY_INPUT;
+        return output;
     }
 
-    json_parser_destroy(&parser);
+    if (!(filter_path = select_compile(&filter->path, 1)))
+    {
+        output->error = JSON_ERROR_MEMORY;
+        return output;
+    }
+
+    json_parser_init_buffer(&parser, buf, len);
+    parser.filter = filter;
+    parser.filter_path = filter_path;
+
+    // only arrays of records can be filtered
+    if ((c = json_peek(&parser)) != '[' && c != '\0')
+    {
+        parser.error = JSON_ERROR_INVALID_JSON;
+    }
+    else
+    {
+        output->root = parse_root(&parser);
+    }
+    output->error = parser.error;
+    output->buffer_idx = parser.buffer_idx;
+
+    select_destroy(filter_path);
     return output;
 }
 
+/*
+ * Parse the parser's buffer as one JSON text for the other front ends. Return
+ * NULL on error or if nothing was built
+ */
+json *json_parser_run(json_parser *parser)
+{
+    json *root = parse_root(parser);
+    return root == VALIDATED_VALUE ? NULL : root;
+}
+
+/*
+ * Like json_parser_run with the JSON_PARSE_* flags of options, which may be NULL
+ */
+json *json_parser_run_ex(json_parser *parser, const json_parse_options *options)
+{
+    json *root;
+
+    parser->trusted = options && (options->flags & JSON_PARSE_TRUSTED);
+    parser->pack_numbers = options && (options->flags & JSON_PARSE_PACK_NUMBERS);
+    parser->mem_limit = options ? options->max_bytes : 0;
+
+    // without memory for the count the containers grow as usual
+    if (options && (options->flags & JSON_PARSE_EXACT_SIZE) && !parser->source
+        && (parser->sizes = (json_size_counter *) json_malloc(sizeof(json_size_counter))))
+    {
+        memset(parser->sizes, 0, sizeof(json_size_counter));
+        parser->sizes->idx = parser->buffer_idx;
+    }
+
+    root = json_parser_run(parser);
+
+    json_free(parser->sizes);
+    parser->sizes = NULL;
+    return root;
+}
+
+/*
+ * Parse the value at the parser's cursor, see parse_value
+ */
+json *json_parser_parse_value(json_parser *parser)
+{
+    json *value = parse_value(parser);
+    return value == VALIDATED_VALUE ? NULL : value;
+}
+
 
 static void json_parser_init(json_parser *parser, const char *json_string)
 {
-    parser->buffer = (unsigned char *) strdup(json_string);
-    parser->buffer_sz = strlen(json_string) + 1;
+    json_parser_init_buffer(parser, json_strdup(json_string), strlen(json_string));
+}
+
+/*
+ * Point the parser at len bytes of buf. The buffer is not copied; the end of
+ * the buffer is treated like a terminating NUL character.
+ */
+void json_parser_init_buffer(json_parser *parser, const char *buf, size_t len)
+{
+    parser->buffer = (unsigned char *) buf;
+    parser->buffer_sz = len;
     parser->buffer_idx = 0;
+    parser->source = NULL;
+    parser->offset = 0;
+    parser->output = NULL;
     parser->skip_space = true;
+    parser->materialize = true;
+    parser->trusted = false;
+    parser->pack_numbers = false;
+    parser->pool = NULL;
+    parser->sizes = NULL;
+    parser->mem_used = 0;
+    parser->mem_limit = 0;
+    parser->select = NULL;
+    parser->probe = NULL;
+    parser->filter = NULL;
+    parser->filter_path = NULL;
     parser->error = 0;
     parser->depth = 0;
 }
@@ -686,7 +1478,7 @@ static void json_parser_init(json_parser *parser, const char *json_string)
 
 static void json_parser_destroy(json_parser *parser)
 {
-    free(parser->buffer);
+    json_free(parser->buffer);
 }
 
 
@@ -694,7 +1486,10 @@ static json_output *json_output_new()
 {
     json_output *output;
 
-    output = (json_output *) calloc(1, sizeof(json_output));
+    output = (json_output *) json_calloc(1, sizeof(json_output));
+    if (!output)
+        return NULL;
+
     output->root  = NULL;
     output->error = 0;
     output->buffer_idx = 0;
@@ -702,38 +1497,497 @@ static json_output *json_output_new()
 }
 
 
+/* SELECTION */
+
+/*
+ * Build the path trie used by json_parse_select. Path components are
+ * separated by '/' and may use the JSON pointer escapes ~0 and ~1. Return NULL
+ * if memory ran out
+ */
+static json_select_node *select_compile(const char *const *paths, size_t n)
+{
+    json_select_node *root = (json_select_node *) json_calloc(1, sizeof(json_select_node));
+    size_t            i;
+
+    if (!root)
+        return NULL;
+
+    root->index = -1;
+
+    for (i = 0; i < n; i++)
+    {
+        json_select_node *node = root;
+        const char       *path = paths[i];
+
+        if (!path)
+            continue;
+
+        if (*path == '/')
+            path++;
+
+        while (*path)
+        {
+            size_t len = strcspn(path, "/");
+            if (!(node = select_add_child(node, path, len)))
+                goto ERROR;
+            path += len;
+            if (*path == '/')
+                path++;
+        }
+
+        node->terminal = true;
+    }
+
+    if (!select_normalize(root))
+        goto ERROR;
+    return root;
+
+ERROR:
+    select_destroy(root);
+    return NULL;
+}
+
+/*
+ * Return the child of node with the given name, adding it if it does not exist,
+ * NULL if memory ran out
+ */
+static json_select_node *select_add_child(json_select_node *node, const char *name, size_t len)
+{
+    json_select_node  *child = NULL;
+    json_select_node **children = NULL;
+    char              *end = NULL;
+    size_t             i, j;
+
+    for (i = 0; i < node->cnt; i++)
+    {
+        child = node->children[i];
+        if (child->name_len == len && memcmp(child->name, name, len) == 0)
+            return child;
+    }
+
+    children = (json_select_node **) json_realloc(node->children,
+        sizeof(json_select_node *) * (node->cnt + 1));
+    if (!children)
+        return NULL;
+    node->children = children;
+
+    if (!(child = (json_select_node *) json_calloc(1, sizeof(json_select_node))))
+        return NULL;
+    if (!(child->name = (char *) json_malloc(len + 1)))
+    {
+        json_free(child);
+        return NULL;
+    }
+
+    // unescape ~1 to '/' and ~0 to '~'
+    for (i = 0, j = 0; i < len; i++, j++)
+    {
+        if (name[i] == '~' && i + 1 < len && (name[i + 1] == '0' || name[i + 1] == '1'))
+            child->name[j] = name[++i] == '0' ? '~' : '/';
+        else
+            child->name[j] = name[i];
+    }
+    child->name[j] = '\0';
+    child->name_len = j;
+    child->wildcard = (strcmp(child->name, "*") == 0);
+
+    child->index = -1;
+    if (isdigit((unsigned char) child->name[0]) 
+        && (child->name[0] != '0' || child->name_len == 1))
+    {
+        long index = strtol(child->name, &end, 10);
+        if (*end == '\0' && index <= INT_MAX)
+            child->index = index;
+    }
+
+    node->children[node->cnt++] = child;
+    return child;
+}
+
+/*
+ * Copy the paths below src into dst, false if memory ran out
+ */
+static bool select_merge(json_select_node *dst, const json_select_node *src)
+{
+    size_t i;
+
+    dst->terminal = dst->terminal || src->terminal;
+
+    for (i = 0; i < src->cnt; i++)
+    {
+        const json_select_node *child = src->children[i];
+        json_select_node       *copy = select_add_child(dst, child->name, child->name_len);
+
+        if (!copy || !select_merge(copy, child))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Merge the wildcard paths into their named siblings so that a member or an
+ * element only ever follows one node: the named one if it exists. Return false
+ * if memory ran out
+ */
+static bool select_normalize(json_select_node *node)
+{
+    json_select_node *any = NULL;
+    size_t            i;
+
+    for (i = 0; i < node->cnt; i++)
+    {
+        if (node->children[i]->wildcard)
+            any = node->children[i];
+    }
+
+    for (i = 0; i < node->cnt; i++)
+    {
+        if (any && node->children[i] != any && !select_merge(node->children[i], any))
+            return false;
+        if (!select_normalize(node->children[i]))
+            return false;
+    }
+    return true;
+}
+
+static void select_destroy(json_select_node *node)
+{
+    size_t i;
+
+    for (i = 0; i < node->cnt; i++)
+    {
+        select_destroy(node->children[i]);
+    }
+    json_free(node->children);
+    json_free(node->name);
+    json_free(node);
+}
+
+/*
+ * Return the node an object member with the given key follows or NULL
+ */
+static const json_select_node *select_child(const json_select_node *node,
+    const unsigned char *name, size_t len)
+{
+    const json_select_node *any = NULL;
+    size_t                  i;
+
+    for (i = 0; i < node->cnt; i++)
+    {
+        const json_select_node *child = node->children[i];
+
+        if (child->wildcard)
+            any = child;
+        else if (child->name_len == len && memcmp(child->name, name, len) == 0)
+            return child;
+    }
+    return any;
+}
+
+/*
+ * Return the node the array element at idx follows or NULL
+ */
+static const json_select_node *select_child_at(const json_select_node *node, size_t idx)
+{
+    const json_select_node *any = NULL;
+    size_t                  i;
+
+    for (i = 0; i < node->cnt; i++)
+    {
+        const json_select_node *child = node->children[i];
+
+        if (child->wildcard)
+            any = child;
+        else if (child->index >= 0 && (size_t) child->index == idx)
+            return child;
+    }
+    return any;
+}
+
+
+/*
+ * Account for bytes more taken by the tree, failing once the parse's budget is
+ * spent
+ */
+static bool mem_charge(json_parser *parser, size_t bytes)
+{
+    parser->mem_used += bytes;
+    if (parser->mem_limit && parser->mem_used > parser->mem_limit)
+    {
+        SET_PARSER_ERROR(parser, JSON_ERROR_MEMORY_LIMIT);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Create a value, from the parser's pool if it has one
+ */
+static json *node_create(json_parser *parser, json_type type)
+{
+    json *js = parser->pool ? json_pool_node(parser->pool, type) : json_create(type);
+
+    if (!js)
+    {
+        SET_PARSER_ERROR(parser, JSON_ERROR_MEMORY);
+        return NULL;
+    }
+
+    if (!mem_charge(parser, JSON_NODE_SIZE(type) + (JSON_IS_STRING(js) ? js->alloced : 0)))
+    {
+        node_destroy(parser, js);
+        return NULL;
+    }
+    return js;
+}
+
+/*
+ * Destroy a value, giving its memory back to the parser's pool if it has one
+ */
+static void node_destroy(json_parser *parser, json *js)
+{
+    if (parser->pool)
+        json_pool_recycle(parser->pool, js);
+    else
+        json_destroy(js);
+}
+
+static obj_pair *pair_create(json_parser *parser)
+{
+    obj_pair *pair = parser->pool
+        ? json_pool_pair(parser->pool)
+        : (obj_pair *) json_calloc(1, sizeof(obj_pair));
+
+    if (!pair)
+    {
+        SET_PARSER_ERROR(parser, JSON_ERROR_MEMORY);
+        return NULL;
+    }
+
+    if (!mem_charge(parser, sizeof(obj_pair)))
+    {
+        json_free(pair);
+        return NULL;
+    }
+    return pair;
+}
+
+/*
+ * Give the string, members or elements of js room for alloced elements of
+ * elem_sz bytes. On failure js keeps its old buffer
+ */
+static bool buffer_resize(json_parser *parser, json *js, size_t alloced, size_t elem_sz)
+{
+    size_t  capacity = alloced * elem_sz;
+    size_t  old_alloced = js->alloced;
+    void   *block;
+
+    if (parser->pool)
+        block = json_pool_block(parser->pool, capacity, &capacity);
+    else
+        block = json_realloc(js->string_val, capacity);
+
+    if (!block)
+    {
+        SET_PARSER_ERROR(parser, JSON_ERROR_MEMORY);
+        return false;
+    }
+
+    if (parser->pool)
+    {
+        if (js->cnt)
+            memcpy(block, js->string_val, js->cnt * elem_sz);
+        json_pool_give_block(parser->pool, js->string_val, js->alloced * elem_sz);
+    }
+
+    js->string_val = (unsigned char *) block;
+    js->alloced = capacity / elem_sz;
+    return mem_charge(parser, (js->alloced - old_alloced) * elem_sz);
+}
+
+/*
+ * Make room for size bytes in string
+ */
+static bool string_reserve(json_parser *parser, json *string, size_t size)
+{
+    if (size <= string->alloced)
+        return true;
+
+    if (parser->pool && size < 2 * string->alloced)
+        size = 2 * string->alloced;
+
+    return buffer_resize(parser, string, size, sizeof(unsigned char));
+}
+
+/*
+ * Count the members of containers ahead of the parser, until the one it opens
+ * as the nth is closed or the count is JSON_SIZE_WINDOW bytes or
+ * JSON_SIZE_SLOTS containers ahead. Strings are skipped by their quotes and
+ * escapes and nothing is checked, that is left to the parser
+ */
+static void count_sizes(json_parser *parser, size_t nth)
+{
+    json_size_counter   *counter = parser->sizes;
+    const unsigned char *buf = parser->buffer;
+    size_t               end = parser->buffer_idx + JSON_SIZE_WINDOW;
+    size_t               i = counter->idx;
+
+    if (end > parser->buffer_sz)
+        end = parser->buffer_sz;
+
+    while (i < end && !counter->sizes[nth % JSON_SIZE_SLOTS]
+           && counter->opened < nth + JSON_SIZE_SLOTS)
+    {
+        unsigned char c = buf[i++];
+        size_t        top = counter->depth - 1; // innermost container followed
+
+        switch (c)
+        {
+            case ' ': case '\t': case '\n': case '\r':
+                continue;
+            case ',':
+                if (counter->depth && counter->depth <= JSON_SIZE_DEPTH)
+                    counter->count[top]++;
+                continue;
+            case ']': case '}':
+                if (!counter->depth)
+                    continue;
+                // a container the parser already opened has no use for its size
+                if (counter->depth-- <= JSON_SIZE_DEPTH && counter->open[top] >= counter->next)
+                    counter->sizes[counter->open[top] % JSON_SIZE_SLOTS] = counter->count[top] + 1;
+                continue;
+            default:
+                break;
+        }
+
+        // the first member makes a container count one
+        if (counter->depth && counter->depth <= JSON_SIZE_DEPTH && counter->count[top] == 0)
+            counter->count[top] = 1;
+
+        if (c == '"')
+        {
+            // the closing quote is the first one not escaped by a backslash
+            for (;;)
+            {
+                const unsigned char *quote = (const unsigned char *) memchr(buf + i, '"',
+                    parser->buffer_sz - i);
+                size_t               backslashes = 0;
+
+                if (!quote)
+                {
+                    i = parser->buffer_sz;
+                    break;
+                }
+
+                i = quote - buf + 1;
+                while (buf[i - 2 - backslashes] == '\\')
+                    backslashes++;
+                if (backslashes % 2 == 0)
+                    break;
+            }
+        }
+        else if (c == '[' || c == '{')
+        {
+            if (counter->depth < JSON_SIZE_DEPTH)
+            {
+                counter->open[counter->depth] = counter->opened;
+                counter->count[counter->depth] = 0;
+            }
+            counter->depth++;
+            counter->opened++;
+        }
+    }
+
+    counter->idx = i;
+}
+
+/*
+ * Allocate the members of the container js just opened at the size counted
+ * for it, js is NULL for a container only validated. The counts only follow
+ * the brackets, so input they got wrong still grows through arr_realloc
+ */
+static bool reserve_exact(json_parser *parser, json *js)
+{
+    json_size_counter *counter = parser->sizes;
+    size_t            *slot = &counter->sizes[counter->next % JSON_SIZE_SLOTS];
+    size_t             size;
+
+    count_sizes(parser, counter->next);
+    size = *slot;
+    *slot = 0;
+    counter->next++;
+
+    if (!js || size <= 1)
+        return true;
+
+    return buffer_resize(parser, js, size - 1, SLOT_SIZE(js));
+}
+
 /*
  * Reallocate the C arrays used within the json structures 
  */
-static void arr_realloc(json *js)
+static bool arr_realloc(json_parser *parser, json *js)
 {
     /*
     For strings we should have enough space for terminal byte and 4 unicode bytes
     */
     if ((JSON_IS_STRING(js) 
-        && (js->cnt > js->alloced - BYTES_PER_UNICODE_CHAR - 1)) 
+        && (js->cnt + BYTES_PER_UNICODE_CHAR + 1 > js->alloced)) 
         || (!JSON_IS_STRING(js) 
             && (js->cnt == js->alloced)))
     {
-        js->alloced += 10;
+        size_t elem_sz = JSON_IS_STRING(js) ? sizeof(unsigned char) : SLOT_SIZE(js);
+
+        // pooled blocks double so that the same sizes come back document after document
+        if (parser->pool)
+            return buffer_resize(parser, js, 2 * (js->alloced + 4), elem_sz);
+
+        return buffer_resize(parser, js, js->alloced + 10, elem_sz);
+    }
+
+    return true;
+}
+
+/*
+ * Turn the packed array js into an array of number values, once a value that
+ * is not a number follows its numbers. On failure js is left holding the
+ * values made so far
+ */
+static bool array_unpack(json_parser *parser, json *js)
+{
+    double *numbers = js->numbers;
+    size_t  cnt = js->cnt;
+    size_t  alloced = js->alloced;
+    size_t  i;
+    bool    ok = true;
+
+    js->flags &= ~JSON_PACKED;
+    js->elements = NULL;
+    js->cnt = 0;
+    js->alloced = 0;
+
+    if (!buffer_resize(parser, js, alloced, sizeof(json *)))
+        ok = false;
+
+    for (i = 0; ok && i < cnt; i++)
+    {
+        json *number = node_create(parser, JSON_TYPE_NUMBER);
 
-        switch (js->type)
+        if (!number)
         {
-            case JSON_TYPE_OBJECT:
-                js->members = (obj_pair **) realloc(js->members, 
-                    sizeof(obj_pair *) * js->alloced);
-                break;
-            case JSON_TYPE_ARRAY:
-                js->elements = (json **) realloc(js->elements, 
-                    sizeof(json *) * js->alloced);
-                break;
-            case JSON_TYPE_STRING:
-                js->string_val = (unsigned char *) realloc(js->string_val, 
-                    sizeof(unsigned char) * js->alloced);
-            default:
-                break;
+            ok = false;
+            break;
         }
+        number->num_val = numbers[i];
+        js->elements[js->cnt++] = number;
     }
+
+    if (parser->pool)
+        json_pool_give_block(parser->pool, numbers, alloced * sizeof(double));
+    else
+        json_free(numbers);
+    parser->mem_used -= alloced * sizeof(double);
+    return ok;
 }
 
 /*
@@ -742,7 +1996,7 @@ static void arr_realloc(json *js)
 void json_output_destroy(json_output *jo)
 {
     json_destroy(jo->root);
-    free(jo);
+    json_free(jo);
 }
 
 /*
@@ -753,19 +2007,27 @@ bool json_parser_found_error(json_output *jo)
     return jo->error != 0;
 }
 
-int json_parser_get_error_loc(json_output *jo)
+size_t json_parser_get_error_loc(json_output *jo)
 {
     return jo->error ? jo->buffer_idx : 0;
 }
 
 const char *json_parser_get_error(json_output *jo)
 {
-    if (jo->error < 0)
+    return json_error2string(jo->error);
+}
+
+/*
+ * Return the message for a parser error code
+ */
+const char *json_error2string(int error)
+{
+    if (error < 0)
     {
-        return utf8proc_errmsg(jo->error);
+        return utf8proc_errmsg(error);
     }
 
-    switch (jo->error) 
+    switch (error) 
     {
         case JSON_ERROR_NONE:
             return "No error";
@@ -795,6 +2057,12 @@ const char *json_parser_get_error(json_output *jo)
             return "Parser max depth exceeded";
         case JSON_ERROR_ILLEGAL_CHARACTER:
             return "Illegal character encountered";
+        case JSON_ERROR_MEMORY:
+            return "Out of memory";
+        case JSON_ERROR_IO:
+            return "Input file could not be read";
+        case JSON_ERROR_MEMORY_LIMIT:
+            return "Memory limit exceeded";
         default:
             return "Unknown error happened in the parser";
     }
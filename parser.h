@@ -1,10 +1,14 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdio.h>
 #include <stdbool.h>
 #include "json.h"
 
 #define JSON_PARSER_MAX_DEPTH      512
+#define JSON_SIZE_WINDOW           4096 // bytes the member count runs ahead of the parser
+#define JSON_SIZE_SLOTS            512  // containers counted ahead of the parser
+#define JSON_SIZE_DEPTH            64   // nesting the member count follows
 
 typedef enum json_error
 {
@@ -23,22 +27,132 @@ typedef enum json_error
     JSON_ERROR_INVALID_NUM_FORMAT,
     JSON_ERROR_PARSER_MAX_DEPTH_EXCEEDED,
     JSON_ERROR_ILLEGAL_CHARACTER,
-    ERROR_MEMORY,
+    JSON_ERROR_MEMORY, // an allocation failed
+    JSON_ERROR_IO, // the input file could not be opened or read
+    JSON_ERROR_MEMORY_LIMIT, // the tree outgrew json_parse_options.max_bytes
 } json_error;
 
+/* node of the path trie built by json_parse_select */
+typedef struct json_select_node json_select_node;
+struct json_select_node
+{
+    char              *name;     // unescaped path component
+    size_t             name_len;
+    long               index;    // the component as an array index or -1
+    bool               wildcard; // "*" matches every key and index
+    bool               terminal; // a path ends here, select the whole value
+    json_select_node **children;
+    size_t             cnt;
+};
+
+/* what json_parse_filter found at the filtered path of a record */
+typedef struct json_probe
+{
+    json_type type;      // JSON_TYPE_NONE if the record has no such field
+    double    num_val;
+    bool      bool_val;
+    size_t    str_start; // index of the string's opening quote in the buffer
+    size_t    str_len;   // length of the string as written, escapes included
+} json_probe;
+
+/* input the parser reads in pieces, through a buffer of fixed size */
+typedef struct json_source
+{
+    int            fd;       // read from when fp is NULL
+    FILE          *fp;
+    unsigned char *buf;      // the parser's buffer
+    size_t         buf_size;
+    bool           eof;
+} json_source;
+
+#define JSON_POOL_CLASSES          64
+
+/*
+ * Memory of earlier documents kept by a json_parser_ctx to build the next ones.
+ * Every block is an ordinary malloc block, so trees built from the pool can be
+ * changed and destroyed like any other
+ */
+/* a container json_pool_recycle is taking apart and the index of its next value */
+typedef struct json_pool_frame
+{
+    json      *js;
+    size_t     idx;
+} json_pool_frame;
+
+typedef struct json_pool
+{
+    json      *nodes;   // free strings, arrays and objects, linked through elements
+    json      *scalars; // free numbers, booleans and nulls, see JSON_NODE_SIZE
+    obj_pair  *pairs;   // free pairs, linked through value
+    void      *blocks[JSON_POOL_CLASSES]; // free buffers of at least 2^i bytes,
+                                          // linked through their first word
+    size_t     mallocs; // blocks the pool did not have and allocated
+    json_pool_frame *frames; // stack of json_pool_recycle, kept for the next tree
+    size_t     num_frames;
+} json_pool;
+
+struct json_parser_ctx
+{
+    json_pool    pool;
+    json_output  output;
+};
+
+/*
+ * Counts the members of containers a window ahead of the parser, see
+ * JSON_PARSE_EXACT_SIZE. Containers that close within the window get their
+ * size, larger or deeper ones grow as usual
+ */
+typedef struct json_size_counter
+{
+    size_t  idx;      // next byte to count
+    size_t  opened;   // containers opened so far
+    size_t  next;     // containers the parser opened so far
+    size_t  depth;
+    size_t  open[JSON_SIZE_DEPTH];  // containers still open, by the order they opened
+    size_t  count[JSON_SIZE_DEPTH]; // and their members so far
+    size_t  sizes[JSON_SIZE_SLOTS]; // members + 1 of the containers closed ahead, 0 if unknown
+} json_size_counter;
+
 /* parser object */
 typedef struct json_parser 
 {
     // buffer specific fields
     unsigned char *buffer;
-    int           buffer_sz;
-    int           buffer_idx;
+    size_t        buffer_sz;
+    size_t        buffer_idx;
+    json_source  *source; // refills the buffer when set, NULL for whole buffers
+    size_t        offset; // bytes of a streamed input dropped before the buffer
 
     json_output  *output;
     bool          skip_space; // TODO don't like the design for this
+    bool          materialize; // build json values or only validate them
+    bool          trusted; // skip the checks valid input never fails, see JSON_PARSE_TRUSTED
+    bool          pack_numbers; // keep arrays of numbers packed, see JSON_PARSE_PACK_NUMBERS
+    json_pool    *pool;   // memory to build the values from, NULL to use malloc
+    json_size_counter *sizes; // sizes of the containers ahead, see JSON_PARSE_EXACT_SIZE
+    size_t        mem_used;  // bytes allocated for the tree so far
+    size_t        mem_limit; // most bytes the tree may take, 0 for no limit
+    const json_select_node *select; // paths still to follow, NULL to take all
+    json_probe   *probe;  // set while looking for the filtered field of a record
+    const json_filter      *filter; // keep only the matching top level records
+    const json_select_node *filter_path;
     int           error;
     int           depth;
 } json_parser;
 
+/* parser internals shared with the other parsing front ends */
+void  json_parser_init_buffer(json_parser *parser, const char *buf, size_t len);
+json *json_parser_run(json_parser *parser);
+json *json_parser_parse_value(json_parser *parser);
+json *json_parser_run_ex(json_parser *parser, const json_parse_options *options);
+
+/* pools of json_parser_ctx */
+json     *json_pool_node(json_pool *pool, json_type type);
+obj_pair *json_pool_pair(json_pool *pool);
+void     *json_pool_block(json_pool *pool, size_t size, size_t *capacity);
+void      json_pool_give_block(json_pool *pool, void *block, size_t size);
+void      json_pool_recycle(json_pool *pool, json *js);
+void      json_pool_release(json_pool *pool);
+
 #endif // PARSER_H
 
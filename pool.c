@@ -0,0 +1,387 @@
+/*
+ * Parser contexts and their memory pools
+ *
+ * A json_parser_ctx keeps the values, pairs and buffers of the document it
+ * parsed last and builds the next document out of them, so that parsing many
+ * documents of a similar shape soon stops calling malloc.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+#include "parser.h"
+#include "alloc.h"
+#include "utils.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+// the real size of a block, which may be more than was asked for
+#define BLOCK_SIZE(block, size)    (json_allocator_is_libc() ? malloc_usable_size(block) : (size))
+#else
+#define BLOCK_SIZE(block, size)    (size)
+#endif
+
+#define POOL_STRING_SIZE           16
+#define POOL_CLASS_SEARCH          3 // larger classes tried before allocating
+
+static int size_class(size_t size);
+
+
+/*
+ * Create a parser context for json_parser_ctx_parse
+ */
+json_parser_ctx *json_parser_ctx_create(void)
+{
+    return (json_parser_ctx *) json_calloc(1, sizeof(json_parser_ctx));
+}
+
+/*
+ * Parse the len bytes of buf like json_parse_ex, building the tree out of the
+ * memory of the document ctx parsed before. The output belongs to ctx and is
+ * recycled by the next call: set its root to NULL to keep the tree, which can
+ * then be destroyed with json_destroy. A ctx has to be used with the same
+ * allocator throughout
+ */
+json_output *json_parser_ctx_parse(json_parser_ctx *ctx, const char *buf, size_t len,
+    const json_parse_options *options)
+{
+    LOGFUNC();
+    json_parser           parser;
+    const json_allocator *allocator = json_thread_allocator();
+
+    if (!ctx)
+    {
+        return NULL;
+    }
+
+    if (options && options->allocator)
+        json_use_allocator(options->allocator);
+
+    json_pool_recycle(&ctx->pool, ctx->output.root);
+    memset(&ctx->output, 0, sizeof(json_output));
+
+    if (!buf)
+    {
+        ctx->output.error = JSON_ERROR_EMPTY_INPUT;
+    }
+    else
+    {
+        json_parser_init_buffer(&parser, buf, len);
+        parser.pool = &ctx->pool;
+
+        ctx->output.root = json_parser_run_ex(&parser, options);
+        ctx->output.error = parser.error;
+        ctx->output.buffer_idx = parser.buffer_idx;
+    }
+
+    json_use_allocator(allocator);
+    return &ctx->output;
+}
+
+/*
+ * Destroy ctx, its last output and the memory it kept
+ */
+void json_parser_ctx_destroy(json_parser_ctx *ctx)
+{
+    if (!ctx)
+    {
+        return;
+    }
+
+    json_destroy(ctx->output.root);
+    json_pool_release(&ctx->pool);
+    json_free(ctx);
+}
+
+
+/* ========== POOLS ========== */
+
+/*
+ * Return a zeroed value of the given type, NULL if memory ran out. Strings come
+ * with a small buffer holding the empty string
+ */
+json *json_pool_node(json_pool *pool, json_type type)
+{
+    json **list = JSON_NODE_SIZE(type) == sizeof(json) ? &pool->nodes : &pool->scalars;
+    json  *js = *list;
+
+    if (js)
+    {
+        *list = (json *) js->elements;
+    }
+    else if ((js = (json *) json_malloc(JSON_NODE_SIZE(type))))
+    {
+        pool->mallocs++;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    memset(js, 0, JSON_NODE_SIZE(type));
+    js->type = type;
+
+    if (type == JSON_TYPE_STRING)
+    {
+        js->string_val = (unsigned char *) json_pool_block(pool, POOL_STRING_SIZE, &js->alloced);
+        if (!js->string_val)
+        {
+            js->elements = (json **) *list;
+            *list = js;
+            return NULL;
+        }
+        js->string_val[0] = '\0';
+    }
+
+    return js;
+}
+
+/*
+ * Return a zeroed pair, NULL if memory ran out
+ */
+obj_pair *json_pool_pair(json_pool *pool)
+{
+    obj_pair *pair = pool->pairs;
+
+    if (pair)
+    {
+        pool->pairs = (obj_pair *) pair->value;
+    }
+    else if ((pair = (obj_pair *) json_malloc(sizeof(obj_pair))))
+    {
+        pool->mallocs++;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    memset(pair, 0, sizeof(obj_pair));
+    return pair;
+}
+
+/*
+ * Return a block of at least size bytes and its real size in capacity, NULL if
+ * memory ran out
+ */
+void *json_pool_block(json_pool *pool, size_t size, size_t *capacity)
+{
+    void *block = NULL;
+    int   c, i;
+
+    if (size < sizeof(void *))
+        size = sizeof(void *);
+
+    // the smallest class whose blocks all fit size
+    c = size_class(size);
+    if (((size_t) 1 << c) < size)
+        c++;
+
+    for (i = c; i < c + POOL_CLASS_SEARCH && i < JSON_POOL_CLASSES; i++)
+    {
+        if ((block = pool->blocks[i]))
+        {
+            pool->blocks[i] = *(void **) block;
+            *capacity = BLOCK_SIZE(block, (size_t) 1 << i);
+            return block;
+        }
+    }
+
+    if (!(block = json_malloc((size_t) 1 << c)))
+        return NULL;
+    pool->mallocs++;
+    *capacity = BLOCK_SIZE(block, (size_t) 1 << c);
+    return block;
+}
+
+/*
+ * Keep block, known to hold at least size bytes, for reuse
+ */
+void json_pool_give_block(json_pool *pool, void *block, size_t size)
+{
+    int c;
+
+    if (!block)
+        return;
+
+    size = BLOCK_SIZE(block, size);
+    if (size < sizeof(void *))
+    {
+        json_free(block);
+        return;
+    }
+
+    c = size_class(size);
+    *(void **) block = pool->blocks[c];
+    pool->blocks[c] = block;
+}
+
+/*
+ * Give the node of js and its buffer to the pool, the values in it have to be
+ * given already
+ */
+static void pool_give_node(json_pool *pool, json *js)
+{
+    switch (js->type)
+    {
+        case JSON_TYPE_OBJECT:
+            json_pool_give_block(pool, js->members, js->alloced * sizeof(obj_pair *));
+            break;
+        case JSON_TYPE_ARRAY:
+            json_pool_give_block(pool, js->elements,
+                js->alloced * (js->flags & JSON_PACKED ? sizeof(double) : sizeof(json *)));
+            break;
+        case JSON_TYPE_STRING:
+            json_pool_give_block(pool, js->string_val, js->alloced);
+            break;
+        default:
+            break;
+    }
+
+    // values of the same size take each other's place
+    if (JSON_NODE_SIZE(js->type) == sizeof(json))
+    {
+        js->elements = (json **) pool->nodes;
+        pool->nodes = js;
+    }
+    else
+    {
+        js->elements = (json **) pool->scalars;
+        pool->scalars = js;
+    }
+}
+
+/*
+ * Make room for depth frames on the stack of json_pool_recycle
+ */
+static bool pool_reserve_frames(json_pool *pool, size_t depth)
+{
+    json_pool_frame *frames = NULL;
+    size_t           num_frames = pool->num_frames ? pool->num_frames * 2 : 16;
+
+    if (depth <= pool->num_frames)
+        return true;
+
+    if (!(frames = (json_pool_frame *) json_realloc(pool->frames, num_frames * sizeof(json_pool_frame))))
+        return false;
+    pool->frames = frames;
+    pool->num_frames = num_frames;
+    return true;
+}
+
+/*
+ * Take js apart into the pool, like json_destroy does to free it. The
+ * containers being taken apart are kept on a stack of the pool, not the call
+ * stack, so that deep trees take no deep recursion
+ */
+void json_pool_recycle(json_pool *pool, json *js)
+{
+    size_t depth = 0;
+
+    while (js || depth)
+    {
+        json_pool_frame *frame = NULL;
+
+        if (js)
+        {
+            // values moved by json_compact are not pool memory, shared ones not only ours
+            if ((js->flags & (JSON_FIXED_NODE | JSON_FIXED_BUF)) || JSON_IS_SHARED(js))
+            {
+                json_destroy(js);
+            }
+            else if (!(JSON_IS_OBJECT(js) || JSON_IS_ARRAY(js)) || !js->cnt || (js->flags & JSON_PACKED))
+            {
+                pool_give_node(pool, js);
+            }
+            else if (pool_reserve_frames(pool, depth + 1))
+            {
+                pool->frames[depth].js = js;
+                pool->frames[depth++].idx = 0;
+            }
+            else
+            {
+                // no memory for a deeper stack, the values are freed instead
+                json_destroy(js);
+            }
+            js = NULL;
+            continue;
+        }
+
+        frame = &pool->frames[depth - 1];
+        if (frame->idx == frame->js->cnt)
+        {
+            pool_give_node(pool, frame->js);
+            depth--;
+        }
+        else if (JSON_IS_OBJECT(frame->js))
+        {
+            obj_pair *pair = frame->js->members[frame->idx++];
+
+            js = pair->value;
+            json_pool_give_block(pool, pair->key, strlen((char *) pair->key) + 1);
+            pair->value = (json *) pool->pairs;
+            pool->pairs = pair;
+        }
+        else
+        {
+            js = frame->js->elements[frame->idx++];
+        }
+    }
+}
+
+/*
+ * Free everything pool holds
+ */
+void json_pool_release(json_pool *pool)
+{
+    int i;
+
+    while (pool->nodes)
+    {
+        json *js = pool->nodes;
+        pool->nodes = (json *) js->elements;
+        json_free(js);
+    }
+
+    while (pool->scalars)
+    {
+        json *js = pool->scalars;
+        pool->scalars = (json *) js->elements;
+        json_free(js);
+    }
+
+    while (pool->pairs)
+    {
+        obj_pair *pair = pool->pairs;
+        pool->pairs = (obj_pair *) pair->value;
+        json_free(pair);
+    }
+
+    json_free(pool->frames);
+    pool->frames = NULL;
+    pool->num_frames = 0;
+
+    for (i = 0; i < JSON_POOL_CLASSES; i++)
+    {
+        while (pool->blocks[i])
+        {
+            void *block = pool->blocks[i];
+            pool->blocks[i] = *(void **) block;
+            json_free(block);
+        }
+    }
+}
+
+
+/*
+ * Return the largest c with 2^c <= size
+ */
+static int size_class(size_t size)
+{
+    int c = 0;
+
+    while (size >>= 1)
+        c++;
+    return c;
+}
@@ -0,0 +1,142 @@
+/*
+ * Deferred freeing of trees
+ *
+ * json_destroy_async hands trees over to a reclaimer thread, started on first
+ * use, which destroys them in the background so that the caller returns at
+ * once instead of walking and freeing a large tree itself.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "json.h"
+#include "alloc.h"
+
+/* a tree waiting to be destroyed */
+typedef struct reclaim_item
+{
+    json                 *js;
+    const json_allocator *allocator; // of the thread that handed the tree over
+    struct reclaim_item  *next;
+} reclaim_item;
+
+static pthread_once_t   reclaim_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t  reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   reclaim_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   reclaim_idle = PTHREAD_COND_INITIALIZER;
+static reclaim_item    *reclaim_head = NULL;
+static reclaim_item    *reclaim_tail = NULL;
+static bool             reclaim_busy = false;    // the reclaimer is destroying trees
+static bool             reclaim_running = false; // the reclaimer could be started
+
+static void  reclaim_start(void);
+static void *reclaim_worker(void *arg);
+
+
+/*
+ * Destroy js like json_destroy does, but on a background thread. js may not be
+ * used after the call, and the allocator it was built with has to stay valid
+ * until json_destroy_async_wait returns. If no thread can be started or memory
+ * runs out js is destroyed on the spot
+ */
+void json_destroy_async(json *js)
+{
+    reclaim_item *item = NULL;
+
+    if (!js)
+    {
+        return;
+    }
+
+    // values without others in them are freed at once anyway
+    if (!JSON_IS_OBJECT(js) && !JSON_IS_ARRAY(js))
+    {
+        json_destroy(js);
+        return;
+    }
+
+    pthread_once(&reclaim_once, reclaim_start);
+    if (!reclaim_running || !(item = (reclaim_item *) json_malloc(sizeof(reclaim_item))))
+    {
+        json_destroy(js);
+        return;
+    }
+
+    item->js = js;
+    item->allocator = json_thread_allocator();
+    item->next = NULL;
+
+    pthread_mutex_lock(&reclaim_lock);
+    if (reclaim_tail)
+        reclaim_tail->next = item;
+    else
+        reclaim_head = item;
+    reclaim_tail = item;
+    pthread_cond_signal(&reclaim_queued);
+    pthread_mutex_unlock(&reclaim_lock);
+}
+
+/*
+ * Wait until every tree handed to json_destroy_async so far is destroyed
+ */
+void json_destroy_async_wait(void)
+{
+    pthread_mutex_lock(&reclaim_lock);
+    while (reclaim_head || reclaim_busy)
+        pthread_cond_wait(&reclaim_idle, &reclaim_lock);
+    pthread_mutex_unlock(&reclaim_lock);
+}
+
+
+static void reclaim_start(void)
+{
+    pthread_t       thread;
+    pthread_attr_t  attr;
+
+    if (pthread_attr_init(&attr) != 0)
+        return;
+
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    reclaim_running = pthread_create(&thread, &attr, reclaim_worker, NULL) == 0;
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * Destroy the queued trees, a whole queue at a time, for the life of the process
+ */
+static void *reclaim_worker(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&reclaim_lock);
+    for (;;)
+    {
+        reclaim_item *items;
+
+        while (!reclaim_head)
+            pthread_cond_wait(&reclaim_queued, &reclaim_lock);
+
+        items = reclaim_head;
+        reclaim_head = reclaim_tail = NULL;
+        reclaim_busy = true;
+        pthread_mutex_unlock(&reclaim_lock);
+
+        while (items)
+        {
+            reclaim_item *item = items;
+
+            items = item->next;
+            json_use_allocator(item->allocator);
+            json_destroy(item->js);
+            json_free(item);
+        }
+        json_use_allocator(NULL);
+
+        pthread_mutex_lock(&reclaim_lock);
+        reclaim_busy = false;
+        if (!reclaim_head)
+            pthread_cond_broadcast(&reclaim_idle);
+    }
+
+    return NULL;
+}
@@ -1,4 +1,7 @@
 #include "gtest/gtest.h"
+#include <string>
+#include <thread>
+#include <vector>
 
 extern "C" {
     #include "iterator.h"
@@ -161,16 +164,74 @@ TEST(json_object_put_stringTest, basic_update)
     json_output_destroy(output);
 }
 
+TEST(json_object_put_numberTest, value_is_reused)
+{
+    const char  *json_str = "{\"count\": 1, \"name\": \"a longer name\", \"sub\": {}}";
+    json_output *output = json_parse(json_str);
+    json        *object = output->root;
+    json        *count = json_object_get(object, "count");
+    json        *name = json_object_get(object, "name");
+    json        *sub = JSON_OBJECT_CREATE();
+    unsigned char *name_buf = name->string_val;
+
+    for (int i = 0; i < 1000; i++)
+        ASSERT_EQ(API_SUCCESS, json_object_put_number(object, "count", i));
+    ASSERT_EQ(count, json_object_get(object, "count"));
+    ASSERT_EQ(999, count->num_val);
+
+    ASSERT_EQ(API_SUCCESS, json_object_put_boolean(object, "count", true));
+    ASSERT_EQ(count, json_object_get(object, "count"));
+    ASSERT_TRUE(JSON_IS_BOOLEAN(count));
+
+    // a shorter string fits the old buffer, a longer one doesn't
+    ASSERT_EQ(API_SUCCESS, json_object_put_string(object, "name", "short"));
+    ASSERT_EQ(name, json_object_get(object, "name"));
+    ASSERT_EQ(name_buf, name->string_val);
+    ASSERT_EQ(5, json_get_size(name));
+    ASSERT_EQ(API_SUCCESS, json_object_put_string(object, "name", "a name longer than before"));
+    ASSERT_EQ(name, json_object_get(object, "name"));
+    ASSERT_TRUE(json_object_has_string(object, "a name longer than before"));
+
+    // values of other sizes are replaced
+    ASSERT_EQ(API_SUCCESS, json_object_put_string(object, "count", "1"));
+    ASSERT_TRUE(json_object_has_string(object, "1"));
+    ASSERT_EQ(API_SUCCESS, json_object_put_complex_value(object, "sub", sub));
+    ASSERT_EQ(sub, json_object_get(object, "sub"));
+
+    json_output_destroy(output);
+}
+
+TEST(json_object_put_stringTest, compacted_value)
+{
+    const char  *json_str = "{\"name\": \"abc\"}";
+    json_output *output = json_parse(json_str);
+    json        *object = json_compact(output->root, JSON_COMPACT_CONTIGUOUS);
+    json        *name = json_object_get(object, "name");
+
+    output->root = NULL;
+
+    ASSERT_EQ(API_SUCCESS, json_object_put_string(object, "name", "xy"));
+    ASSERT_EQ(JSON_FIXED_NODE | JSON_FIXED_BUF, name->flags);
+    ASSERT_EQ(API_SUCCESS, json_object_put_string(object, "name", "wxyz"));
+    ASSERT_EQ(JSON_FIXED_NODE, name->flags);
+    ASSERT_TRUE(json_object_has_string(object, "wxyz"));
+
+    json_destroy(object);
+    json_output_destroy(output);
+}
+
 TEST(json_object_remove_memberTest, object)
 {
     const char  *json_str = "{\"value\": 0, \"dup_val\": 1, \"dup_val\": 2}";
     json_output *output = json_parse(json_str);
     json        *object = output->root;
 
-    json_object_remove_member(object, "val");
+    ASSERT_EQ(API_SUCCESS, json_object_remove_member(object, "val"));
     ASSERT_EQ(3, json_get_size(object));
+    ASSERT_EQ(API_FAILURE, json_object_remove_member(object, NULL));
+    ASSERT_EQ(API_FAILURE, json_object_remove_member(NULL, "value"));
 
-    json_object_remove_member(object, "value");
+    ASSERT_EQ(API_SUCCESS, json_object_remove_member(object, "value"));
     ASSERT_FALSE(json_object_has_key(object, "value"));
     ASSERT_EQ(2, json_get_size(object));
 
@@ -181,6 +242,82 @@ TEST(json_object_remove_memberTest, object)
     json_output_destroy(output);
 }
 
+static bool is_odd_number(const char *key, json *value, void *ctx)
+{
+    (void) key;
+    ++*(int *) ctx;
+    return JSON_IS_NUMBER(value) && (long) value->num_val % 2;
+}
+
+TEST(json_object_remove_memberTest, duplicates_in_a_row)
+{
+    const char  *json_str = "{\"a\": 0, \"b\": 1, \"b\": 2, \"c\": 3, \"b\": 4}";
+    json_output *output = json_parse(json_str);
+    json        *object = output->root;
+    size_t       alloced = object->alloced;
+
+    json_object_remove_member(object, "b");
+    ASSERT_EQ(2, json_get_size(object));
+    ASSERT_EQ(alloced, object->alloced);
+    ASSERT_EQ(0, json_object_get(object, "a")->num_val);
+    ASSERT_EQ(3, json_object_get(object, "c")->num_val);
+
+    json_output_destroy(output);
+}
+
+TEST(json_object_swap_removeTest, basic)
+{
+    const char  *json_str = "{\"a\": 0, \"b\": 1, \"c\": 2, \"d\": 3, \"b\": 4}";
+    json_output *output = json_parse(json_str);
+    json        *object = output->root;
+
+    ASSERT_EQ(API_SUCCESS, json_object_swap_remove(object, "x"));
+    ASSERT_EQ(5, json_get_size(object));
+    ASSERT_EQ(API_FAILURE, json_object_swap_remove(object, NULL));
+
+    ASSERT_EQ(API_SUCCESS, json_object_swap_remove(object, "b"));
+    ASSERT_EQ(3, json_get_size(object));
+    ASSERT_FALSE(json_object_has_key(object, "b"));
+
+    // the last pairs took the places of the removed ones
+    ASSERT_STREQ("a", (char *) object->members[0]->key);
+    ASSERT_STREQ("d", (char *) object->members[1]->key);
+    ASSERT_STREQ("c", (char *) object->members[2]->key);
+
+    json_output_destroy(output);
+}
+
+TEST(json_object_remove_ifTest, basic)
+{
+    const char  *json_str = "{\"a\": 1, \"b\": 2, \"c\": \"3\", \"d\": 5, \"e\": {}}";
+    json_output *output = json_parse(json_str);
+    json        *object = output->root;
+    int          calls = 0;
+    char        *str = NULL;
+
+    ASSERT_EQ(0u, json_object_remove_if(object, NULL, NULL));
+    ASSERT_EQ(2u, json_object_remove_if(object, is_odd_number, &calls));
+    ASSERT_EQ(5, calls);
+
+    str = json2string(object, 0);
+    ASSERT_STREQ("{\"b\":2.000000,\"c\":\"3\",\"e\":{}}", str);
+    free(str);
+
+    // pairs of a compacted object stay in its block
+    object = json_compact(object, JSON_COMPACT_CONTIGUOUS);
+    output->root = NULL;
+    json_object_swap_remove(object, "b");
+    ASSERT_EQ(0u, json_object_remove_if(object, is_odd_number, &calls));
+    json_object_remove_member(object, "e");
+
+    str = json2string(object, 0);
+    ASSERT_STREQ("{\"c\":\"3\"}", str);
+
+    free(str);
+    json_destroy(object);
+    json_output_destroy(output);
+}
+
 TEST(json_object_getTest, basic)
 {
     const char  *json_str = "{\"pi\": 3.14, \"e\": {\"is_rational\": false}}";
@@ -435,6 +572,106 @@ TEST(json_array_get_stringTest, basic)
     json_output_destroy(output);
 }
 
+TEST(json_array_get_numbersTest, basic)
+{
+    double       numbers[4] = { 0, 0, 0, 0 };
+    size_t       written = 1;
+    json_output *output = json_parse("[1.5, -2, 3, true]");
+    json        *array = output->root;
+
+    ASSERT_EQ(API_FAILURE, json_array_get_numbers(NULL, numbers, 4, &written));
+    ASSERT_EQ(0u, written);
+    ASSERT_EQ(API_FAILURE, json_array_get_numbers(array, NULL, 4, &written));
+
+    ASSERT_EQ(API_SUCCESS, json_array_get_numbers(array, numbers, 2, &written));
+    ASSERT_EQ(2u, written);
+    ASSERT_EQ(-2, numbers[1]);
+
+    // stops at the boolean
+    ASSERT_EQ(API_FAILURE, json_array_get_numbers(array, numbers, 4, &written));
+    ASSERT_EQ(3u, written);
+    ASSERT_EQ(3, numbers[2]);
+
+    json_output_destroy(output);
+}
+
+TEST(json_array_get_numbersTest, packed)
+{
+    const char         *json_str = "[1.5, -2, 3, 4e3]";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    json_output        *output = json_parse_ex(json_str, strlen(json_str), &options);
+    double              numbers[8];
+    int64_t             ints[8];
+    bool                bools[1];
+    size_t              written = 0;
+
+    ASSERT_EQ(API_SUCCESS, json_array_get_numbers(output->root, numbers, 8, &written));
+    ASSERT_EQ(4u, written);
+    ASSERT_EQ(1.5, numbers[0]);
+    ASSERT_EQ(4000, numbers[3]);
+
+    ASSERT_EQ(API_FAILURE, json_array_get_int64s(output->root, ints, 8, &written));
+    ASSERT_EQ(0u, written);
+    ASSERT_EQ(API_FAILURE, json_array_get_booleans(output->root, bools, 1, &written));
+    ASSERT_EQ(API_SUCCESS, json_array_get_booleans(output->root, bools, 0, NULL));
+
+    json_array_remove_at(output->root, 0);
+    ASSERT_EQ(API_SUCCESS, json_array_get_int64s(output->root, ints, 8, &written));
+    ASSERT_EQ(3u, written);
+    ASSERT_EQ(-2, ints[0]);
+    ASSERT_EQ(4000, ints[2]);
+    ASSERT_EQ(JSON_PACKED, output->root->flags);
+
+    json_output_destroy(output);
+}
+
+TEST(json_array_get_int64sTest, basic)
+{
+    int64_t      ints[4] = { 0, 0, 0, 0 };
+    size_t       written = 0;
+    json_output *output = json_parse("[-9007199254740993, 1e18, 9.3e18, 2]");
+
+    // 9.3e18 is past INT64_MAX
+    ASSERT_EQ(API_FAILURE, json_array_get_int64s(output->root, ints, 4, &written));
+    ASSERT_EQ(2u, written);
+    ASSERT_EQ((int64_t) -9007199254740992, ints[0]);
+    ASSERT_EQ((int64_t) 1000000000000000000, ints[1]);
+
+    json_output_destroy(output);
+}
+
+TEST(json_array_get_booleansTest, basic)
+{
+    bool         bools[3] = { false, false, false };
+    size_t       written = 0;
+    json_output *output = json_parse("[true, false, null]");
+
+    ASSERT_EQ(API_FAILURE, json_array_get_booleans(output->root, bools, 3, &written));
+    ASSERT_EQ(2u, written);
+    ASSERT_TRUE(bools[0]);
+    ASSERT_FALSE(bools[1]);
+
+    json_output_destroy(output);
+}
+
+TEST(json_array_get_stringsTest, basic)
+{
+    json_string_view strs[3];
+    size_t           written = 0;
+    json_output     *output = json_parse("[\"a\", \"\\u00e9t\\u00e9\", \"\"]");
+
+    ASSERT_EQ(API_SUCCESS, json_array_get_strings(output->root, strs, 3, &written));
+    ASSERT_EQ(3u, written);
+    ASSERT_STREQ("a", strs[0].str);
+    ASSERT_EQ(1u, strs[0].len);
+    ASSERT_STREQ("\u00e9t\u00e9", strs[1].str);
+    ASSERT_EQ(5u, strs[1].len);
+    ASSERT_EQ(0u, strs[2].len);
+    ASSERT_EQ(json_array_get(output->root, 0)->string_val, (unsigned char *) strs[0].str);
+
+    json_output_destroy(output);
+}
+
 TEST(json_array_add_numberTest, basic)
 {
     int          rv;
@@ -489,6 +726,31 @@ TEST(json_array_add_stringTest, basic)
     json_output_destroy(output);
 }
 
+TEST(json_array_add_numberTest, value_is_reused)
+{
+    const char  *json_str = "[1, null, \"s\", []]";
+    json_output *output = json_parse(json_str);
+    json        *array = output->root;
+    json        *number = json_array_get(array, 0);
+    json        *null = json_array_get(array, 1);
+    json        *list = json_array_get(array, 3);
+    char        *str = NULL;
+
+    ASSERT_EQ(API_SUCCESS, json_array_add_number(array, 0, 2));
+    ASSERT_EQ(API_SUCCESS, json_array_add_boolean(array, 1, false));
+    ASSERT_EQ(API_SUCCESS, json_array_add_string(array, 2, "t"));
+    ASSERT_EQ(number, json_array_get(array, 0));
+    ASSERT_EQ(null, json_array_get(array, 1));
+
+    ASSERT_EQ(API_SUCCESS, json_array_add_string(array, 3, "u"));
+    ASSERT_NE(list, json_array_get(array, 3));
+    str = json2string(array, 0);
+    ASSERT_STREQ("[2.000000,false,\"t\",\"u\"]", str);
+
+    free(str);
+    json_output_destroy(output);
+}
+
 TEST(json_array_index_of_numberTest, basic)
 {
     int          rv;
@@ -545,7 +807,8 @@ TEST(json_array_append_numberTest, basic)
     json        *array = output->root;
     json        *js;
 
-    json_array_append_number(array, test_num);
+    ASSERT_EQ(API_SUCCESS, json_array_append_number(array, test_num));
+    ASSERT_EQ(API_FAILURE, json_array_append_number(NULL, test_num));
 
     js = array->elements[array->cnt - 1];
     ASSERT_EQ(JSON_TYPE_NUMBER, js->type);
@@ -562,7 +825,7 @@ TEST(json_array_append_booleanTest, basic)
     json        *array = output->root;
     json        *js;
 
-    json_array_append_boolean(array, test_bool);
+    ASSERT_EQ(API_SUCCESS, json_array_append_boolean(array, test_bool));
 
     js = array->elements[array->cnt - 1];
     ASSERT_EQ(JSON_TYPE_BOOLEAN, js->type);
@@ -579,7 +842,8 @@ TEST(json_array_append_stringTest, basic)
     json        *array = output->root;
     json        *js;
 
-    json_array_append_string(array, test_str);
+    ASSERT_EQ(API_SUCCESS, json_array_append_string(array, test_str));
+    ASSERT_EQ(API_FAILURE, json_array_append_string(array, NULL));
 
     js = array->elements[array->cnt - 1];
     ASSERT_EQ(JSON_TYPE_STRING, js->type);
@@ -589,6 +853,91 @@ TEST(json_array_append_stringTest, basic)
     json_output_destroy(output);
 }
 
+TEST(json_array_append_numbersTest, basic)
+{
+    double       numbers[1000];
+    json        *array = JSON_ARRAY_CREATE();
+    char        *str = NULL;
+    size_t       written = 0;
+
+    for (int i = 0; i < 1000; i++)
+        numbers[i] = i;
+
+    ASSERT_EQ(API_FAILURE, json_array_append_numbers(NULL, numbers, 1));
+    ASSERT_EQ(API_FAILURE, json_array_append_numbers(array, NULL, 1));
+    ASSERT_EQ(API_SUCCESS, json_array_append_numbers(array, NULL, 0));
+
+    ASSERT_EQ(API_SUCCESS, json_array_reserve(array, 1000));
+    ASSERT_EQ(1000u, array->alloced);
+    ASSERT_EQ(API_SUCCESS, json_array_append_numbers(array, numbers, 999));
+    json_array_append_number(array, 999);
+    ASSERT_EQ(1000u, array->alloced);
+
+    ASSERT_EQ(API_SUCCESS, json_array_get_numbers(array, numbers, 1000, &written));
+    ASSERT_EQ(1000u, written);
+    ASSERT_EQ(999, numbers[999]);
+
+    json_destroy(array);
+
+    array = JSON_ARRAY_CREATE();
+    ASSERT_EQ(API_SUCCESS, json_array_append_numbers(array, numbers, 2));
+    str = json2string(array, 0);
+    ASSERT_STREQ("[0.000000,1.000000]", str);
+
+    free(str);
+    json_destroy(array);
+}
+
+TEST(json_array_append_stringsTest, basic)
+{
+    const char  *strs[] = { "a", "b", NULL };
+    const bool   bools[] = { true, false };
+    json        *array = JSON_ARRAY_CREATE();
+    char        *str = NULL;
+
+    ASSERT_EQ(API_SUCCESS, json_array_append_strings(array, strs, 2));
+    ASSERT_EQ(API_SUCCESS, json_array_append_booleans(array, bools, 2));
+
+    // nothing goes in when one of the strings can't
+    ASSERT_EQ(API_FAILURE, json_array_append_strings(array, strs, 3));
+    ASSERT_EQ(4, json_get_size(array));
+
+    str = json2string(array, 0);
+    ASSERT_STREQ("[\"a\",\"b\",true,false]", str);
+
+    free(str);
+    json_destroy(array);
+}
+
+TEST(json_array_insert_numbersTest, basic)
+{
+    const double        numbers[] = { 1, 2 };
+    const char         *strs[] = { "x", "y" };
+    const bool          bools[] = { true };
+    const char         *json_str = "[0, 3]";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    json_output        *output = json_parse_ex(json_str, strlen(json_str), &options);
+    json               *array = output->root;
+    char               *str = NULL;
+
+    ASSERT_EQ(API_FAILURE, json_array_insert_numbers(array, 3, numbers, 2));
+    ASSERT_EQ(API_FAILURE, json_array_insert_numbers(array, -1, numbers, 2));
+
+    ASSERT_EQ(API_SUCCESS, json_array_insert_numbers(array, 1, numbers, 2));
+    ASSERT_EQ(API_SUCCESS, json_array_insert_numbers(array, 4, numbers, 1));
+    ASSERT_EQ(JSON_PACKED, array->flags);
+
+    ASSERT_EQ(API_SUCCESS, json_array_insert_strings(array, 0, strs, 2));
+    ASSERT_EQ(0, array->flags);
+    ASSERT_EQ(API_SUCCESS, json_array_insert_booleans(array, 2, bools, 1));
+
+    str = json2string(array, 0);
+    ASSERT_STREQ("[\"x\",\"y\",true,0.000000,1.000000,2.000000,3.000000,1.000000]", str);
+
+    free(str);
+    json_output_destroy(output);
+}
+
 TEST(json_array_remove_atTest, basic)
 {
     const char  *json_str = "[\"Hello World\", 3.14, true]";
@@ -596,15 +945,15 @@ TEST(json_array_remove_atTest, basic)
     json        *array = output->root;
 
     // out of bounds
-    json_array_remove_at(array, -1);
+    ASSERT_EQ(API_FAILURE, json_array_remove_at(array, -1));
     ASSERT_EQ(3, json_get_size(array));
 
-    json_array_remove_at(array, 3);
+    ASSERT_EQ(API_FAILURE, json_array_remove_at(array, 3));
     ASSERT_EQ(3, json_get_size(array));
 
     // within bounds
     ASSERT_TRUE(json_array_has_number(array, 3.14));
-    json_array_remove_at(array, 1);
+    ASSERT_EQ(API_SUCCESS, json_array_remove_at(array, 1));
     ASSERT_FALSE(json_array_has_number(array, 3.14));
     ASSERT_EQ(2, json_get_size(array));
 
@@ -621,6 +970,82 @@ TEST(json_array_remove_atTest, basic)
     json_output_destroy(output);
 }
 
+TEST(json_array_remove_atTest, capacity_is_kept)
+{
+    const char  *json_str = "[1, 2, 3, 4]";
+    json_output *output = json_parse(json_str);
+    json        *array = output->root;
+    size_t       alloced = array->alloced;
+    double       numbers[] = { 5, 6, 7, 8 };
+
+    while (!json_is_empty(array))
+        json_array_remove_at(array, 0);
+    ASSERT_EQ(alloced, array->alloced);
+
+    // the room left is used again
+    json_array_append_numbers(array, numbers, 4);
+    ASSERT_EQ(alloced, array->alloced);
+    ASSERT_EQ(8, json_array_get(array, 3)->num_val);
+
+    json_output_destroy(output);
+}
+
+static bool is_odd(json *value, void *ctx)
+{
+    ++*(int *) ctx;
+    return JSON_IS_NUMBER(value) && (long) value->num_val % 2;
+}
+
+TEST(json_array_swap_removeTest, basic)
+{
+    const char         *json_str = "[0, 1, 2, 3]";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    json_output        *outputs[] = { json_parse(json_str),
+                                      json_parse_ex(json_str, strlen(json_str), &options) };
+
+    for (json_output *output : outputs)
+    {
+        json   *array = output->root;
+        double  numbers[3];
+
+        ASSERT_EQ(API_FAILURE, json_array_swap_remove(array, 4));
+        ASSERT_EQ(4, json_get_size(array));
+
+        ASSERT_EQ(API_SUCCESS, json_array_swap_remove(array, 1));
+        ASSERT_EQ(API_SUCCESS, json_array_swap_remove(array, 2));
+        ASSERT_EQ(2, json_get_size(array));
+        ASSERT_EQ(API_SUCCESS, json_array_get_numbers(array, numbers, 3, NULL));
+        ASSERT_EQ(0, numbers[0]);
+        ASSERT_EQ(3, numbers[1]);
+
+        json_output_destroy(output);
+    }
+}
+
+TEST(json_array_remove_ifTest, basic)
+{
+    const char         *json_str = "[0, 1, 2, 3, 5, 6]";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    json_output        *outputs[] = { json_parse(json_str),
+                                      json_parse_ex(json_str, strlen(json_str), &options) };
+
+    for (json_output *output : outputs)
+    {
+        json   *array = output->root;
+        int     calls = 0;
+        char   *str = NULL;
+
+        ASSERT_EQ(3u, json_array_remove_if(array, is_odd, &calls));
+        ASSERT_EQ(6, calls);
+
+        str = json2string(array, 0);
+        ASSERT_STREQ("[0.000000,2.000000,6.000000]", str);
+
+        free(str);
+        json_output_destroy(output);
+    }
+}
+
 /* 
  This calls a set of functions that utilizes the "hidden" json_array_remove_element
  function
@@ -641,9 +1066,10 @@ TEST(json_array_remove_elementTest, basic)
     ASSERT_EQ(2, json_array_index_of_number(array, 3.14));
     ASSERT_EQ(3, json_get_size(array));
 
-    json_array_remove_number(array, 3.14);
+    ASSERT_EQ(API_SUCCESS, json_array_remove_number(array, 3.14));
     ASSERT_FALSE(json_array_has_number(array, 3.14));
     ASSERT_EQ(2, json_get_size(array));
+    ASSERT_EQ(API_FAILURE, json_array_remove_number(array, 3.14));
 
     ASSERT_TRUE(json_array_has_boolean(array, true));
     json_array_remove_boolean(array, true);
@@ -658,6 +1084,646 @@ TEST(json_array_remove_elementTest, basic)
     json_output_destroy(output);
 }
 
+/* ========== COMPACTION ========== */
+
+TEST(json_compactTest, trim)
+{
+    const char  *json_str = "{\"name\": \"text\", \"list\": [1, \"two\", {}], \"empty\": []}";
+    json_output *output = json_parse(json_str);
+    json        *root = output->root;
+    char        *before = json2string(root, 0);
+    char        *after = NULL;
+    json        *list;
+
+    ASSERT_EQ(root, json_compact(root, 0));
+
+    list = json_object_get(root, "list");
+    ASSERT_EQ(3u, root->alloced);
+    ASSERT_EQ(3u, list->alloced);
+    ASSERT_EQ(0u, json_object_get(root, "empty")->alloced);
+    ASSERT_EQ(5u, json_object_get(root, "name")->alloced);
+    ASSERT_EQ(4u, json_array_get(list, 1)->alloced);
+
+    after = json2string(root, 0);
+    ASSERT_STREQ(before, after);
+
+    free(before);
+    free(after);
+    json_output_destroy(output);
+}
+
+TEST(json_compactTest, contiguous)
+{
+    const char  *json_str = "{\"name\": \"text\", \"list\": [1, \"two\", {\"a\": null}], \"empty\": {}}";
+    json_output *output = json_parse(json_str);
+    char        *before = json2string(output->root, 0);
+    char        *after = NULL;
+    json        *root = json_compact(output->root, JSON_COMPACT_CONTIGUOUS);
+    json        *list = json_object_get(root, "list");
+
+    output->root = NULL;
+
+    // depth first: every value comes after its parent and its older siblings
+    ASSERT_EQ(0, root->flags & JSON_FIXED_NODE);
+    ASSERT_LT((char *) root, (char *) json_object_get(root, "name"));
+    ASSERT_LT((char *) json_object_get(root, "name"), (char *) list);
+    ASSERT_LT((char *) json_array_get(list, 0), (char *) json_array_get(list, 2));
+    ASSERT_LT((char *) json_array_get(list, 2), (char *) json_object_get(root, "empty"));
+    ASSERT_EQ(JSON_FIXED_NODE | JSON_FIXED_BUF, list->flags);
+
+    after = json2string(root, 0);
+    ASSERT_STREQ(before, after);
+
+    free(before);
+    free(after);
+    json_destroy(root);
+    json_output_destroy(output);
+}
+
+TEST(json_compactTest, contiguous_tree_can_change)
+{
+    const char  *json_str = "{\"name\": \"text\", \"list\": [1, \"two\"], \"gone\": {\"a\": [true]}}";
+    json_output *output = json_parse(json_str);
+    json        *root = json_compact(output->root, JSON_COMPACT_CONTIGUOUS);
+    json        *list = json_object_get(root, "list");
+    char        *str = NULL;
+
+    output->root = NULL;
+
+    json_array_append_string(list, "three");
+    json_array_add_number(list, 0, 0);
+    json_array_remove_at(list, 1);
+    json_object_put_boolean(root, "name", false);
+    json_object_put_string(root, "added", "value");
+    json_object_remove_member(root, "gone");
+    json_compact(root, 0);
+
+    str = json2string(root, 0);
+    ASSERT_STREQ("{\"name\":false,\"list\":[0.000000,\"three\"],\"added\":\"value\"}", str);
+
+    free(str);
+    json_destroy(root);
+    json_output_destroy(output);
+}
+
+TEST(json_destroyTest, deep_tree)
+{
+    json *root = JSON_OBJECT_CREATE();
+    json *js = root;
+
+    // deeper than the stack would allow a recursive destroy
+    for (int i = 0; i < 1000000; i++)
+    {
+        json *child = JSON_OBJECT_CREATE();
+
+        json_object_put_number(js, "n", i);
+        json_object_put_complex_value(js, "next", child);
+        js = child;
+    }
+    json_object_put_string(js, "end", "here");
+
+    json_destroy(root);
+}
+
+TEST(json_destroyTest, deep_tree_walks)
+{
+    json        *root = JSON_OBJECT_CREATE();
+    json        *js = root;
+    json        *copy = NULL;
+    json        *shared = NULL;
+    json_memory  usage;
+
+    // the functions going through every value don't recurse either
+    for (int i = 0; i < 1000000; i++)
+    {
+        json *child = JSON_OBJECT_CREATE();
+
+        json_object_put_string(js, "s", "abc");
+        json_object_put_complex_value(js, "next", child);
+        js = child;
+    }
+    json_object_put_number(js, "n", 1);
+
+    ASSERT_EQ(API_SUCCESS, json_memory_usage(root, &usage));
+    ASSERT_EQ(1000001 * sizeof(json) + 1000000 * JSON_NODE_SIZE(JSON_TYPE_STRING)
+        + JSON_NODE_SIZE(JSON_TYPE_NUMBER) + 2000001 * sizeof(obj_pair), usage.nodes);
+    ASSERT_EQ(2000001 * sizeof(obj_pair *), usage.containers);
+    ASSERT_EQ(root, json_compact(root, 0));
+    ASSERT_EQ(API_SUCCESS, json_memory_usage(root, &usage));
+    ASSERT_EQ(0, usage.slack);
+
+    ASSERT_TRUE((copy = json_clone(root)));
+    ASSERT_EQ(json_clone_size(root), json_clone_size(copy));
+    ASSERT_TRUE((shared = json_share(root)));
+    ASSERT_EQ(API_FAILURE, json_object_put_boolean(root, "b", true));
+    json_destroy(shared);
+    ASSERT_EQ(API_SUCCESS, json_freeze(root));
+    ASSERT_EQ(API_FAILURE, json_object_put_boolean(js, "b", true));
+
+    json_destroy(copy);
+    json_destroy(root);
+}
+
+TEST(json_destroyTest, compacted_tree)
+{
+    const char  *json_str = "{\"a\": [1, {\"b\": \"c\"}], \"d\": {\"e\": [[]]}}";
+    json_output *output = json_parse(json_str);
+    json        *root = json_compact(output->root, JSON_COMPACT_CONTIGUOUS);
+
+    output->root = NULL;
+
+    // the root is changed to have buffers of its own, its values stay in its block
+    json_object_put_boolean(root, "f", true);
+    ASSERT_EQ(0, root->flags);
+    json_destroy(root);
+    json_output_destroy(output);
+}
+
+TEST(json_cloneTest, basic)
+{
+    const char         *json_str = "{\"name\": \"text\", \"list\": [1, \"two\", {\"a\": null}], \"n\": [1, 2]}";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    json_output        *output = json_parse_ex(json_str, strlen(json_str), &options);
+    char               *before = json2string(output->root, 0);
+    char               *str = NULL;
+    json               *copy = json_clone(output->root);
+
+    ASSERT_EQ(NULL, json_clone(NULL));
+    ASSERT_NE(output->root, copy);
+    str = json2string(copy, 0);
+    ASSERT_STREQ(before, str);
+    free(str);
+
+    // the copy and the original are independent
+    json_object_put_string(copy, "name", "changed");
+    json_array_append_number(json_object_get(copy, "n"), 3);
+    json_object_remove_member(output->root, "list");
+    json_output_destroy(output);
+
+    str = json2string(copy, 0);
+    ASSERT_STREQ("{\"name\":\"changed\",\"list\":[1.000000,\"two\",{\"a\":null}],"
+                 "\"n\":[1.000000,2.000000,3.000000]}", str);
+
+    free(str);
+    free(before);
+    json_destroy(copy);
+}
+
+TEST(json_clone_intoTest, template)
+{
+    const char  *json_str = "{\"status\": \"ok\", \"items\": [], \"count\": 0}";
+    json_output *output = json_parse(json_str);
+    json        *tmpl = output->root;
+    size_t       size = json_clone_size(tmpl);
+    char        *buf = (char *) malloc(size);
+    char        *str = NULL;
+
+    ASSERT_EQ(NULL, json_clone_into(tmpl, buf, size - 1));
+    ASSERT_EQ(NULL, json_clone_into(tmpl, buf + 1, size - 1));
+
+    // the same buffer stamps out a document per request
+    for (int i = 0; i < 3; i++)
+    {
+        json *js = json_clone_into(tmpl, buf, size);
+
+        ASSERT_EQ((void *) buf, (void *) js);
+        json_object_put_number(js, "count", i);
+        json_array_append_string(json_object_get(js, "items"), "item");
+
+        ASSERT_EQ(i, json_object_get(js, "count")->num_val);
+        ASSERT_EQ(1, json_get_size(json_object_get(js, "items")));
+        json_destroy(js);
+    }
+
+    // the template is untouched
+    str = json2string(tmpl, 0);
+    ASSERT_STREQ("{\"status\":\"ok\",\"items\":[],\"count\":0.000000}", str);
+
+    free(str);
+    free(buf);
+    json_output_destroy(output);
+}
+
+TEST(json_shareTest, snapshot_is_immutable)
+{
+    const char  *json_str = "{\"name\": \"text\", \"a\": {\"b\": 1}, \"list\": [1, {\"c\": true}]}";
+    const char  *expected = "{\"name\":\"text\",\"a\":{\"b\":1.000000},\"list\":[1.000000,{\"c\":true}]}";
+    json_output *output = json_parse(json_str);
+    json        *doc = output->root;
+    json        *snapshot = json_share(doc);
+    char        *str = NULL;
+
+    output->root = NULL;
+    json_output_destroy(output);
+
+    ASSERT_EQ(NULL, json_share(NULL));
+    ASSERT_EQ(doc, snapshot);
+
+    // the shared value is not changed in place, json_edit makes a new version
+    ASSERT_EQ(API_FAILURE, json_object_put_string(doc, "name", "changed"));
+    ASSERT_EQ(API_FAILURE, json_object_remove_member(doc, "list"));
+    ASSERT_EQ(API_SUCCESS, json_object_put_number(json_edit(&doc, "/a"), "b", 2));
+    ASSERT_NE(snapshot, doc);
+    ASSERT_EQ(API_SUCCESS, json_object_put_string(doc, "name", "changed"));
+    str = json2string(snapshot, 0);
+    ASSERT_STREQ(expected, str);
+    free(str);
+    str = json2string(doc, 0);
+    ASSERT_STREQ("{\"name\":\"changed\",\"a\":{\"b\":2.000000},\"list\":[1.000000,{\"c\":true}]}", str);
+    free(str);
+
+    json_destroy(snapshot);
+    json_destroy(doc);
+}
+
+TEST(json_shareTest, writable_once_unshared)
+{
+    const char  *json_str = "{\"list\": [1, 2, 3], \"n\": 1, \"o\": {\"p\": true}}";
+    json_output *output = json_parse(json_str);
+    json        *doc = output->root;
+    json        *list = json_object_get(doc, "list");
+    json        *snapshot = json_share(doc);
+    char        *str = NULL;
+
+    output->root = NULL;
+    json_output_destroy(output);
+
+    // taking a reference leaves the values in the tree as they are
+    ASSERT_EQ(1, doc->refs);
+    ASSERT_EQ(0, doc->flags);
+    ASSERT_EQ(0, list->flags);
+    ASSERT_EQ(API_FAILURE, json_object_put_number(doc, "n", 2));
+
+    // and once it is gone the tree is changed in place again
+    json_destroy(snapshot);
+    ASSERT_EQ(0, doc->refs);
+    ASSERT_EQ(API_SUCCESS, json_array_append_number(list, 4));
+    ASSERT_EQ(4, json_get_size(list));
+    ASSERT_EQ(API_SUCCESS, json_object_remove_member(doc, "o"));
+    ASSERT_FALSE(json_object_has_key(doc, "o"));
+    ASSERT_EQ(API_SUCCESS, json_object_put_number(doc, "n", 2));
+    ASSERT_EQ(list, json_edit(&doc, "/list"));
+
+    str = json2string(doc, 0);
+    ASSERT_STREQ("{\"list\":[1.000000,2.000000,3.000000,4.000000],\"n\":2.000000}", str);
+
+    free(str);
+    json_destroy(doc);
+}
+
+TEST(json_editTest, copies_the_path)
+{
+    const char  *json_str = "{\"a\": {\"b\": [1, {\"c\": true}], \"d/e\": \"x\"}, \"f\": [3]}";
+    json_output *output = json_parse(json_str);
+    json        *doc = output->root;
+    json        *snapshot = json_share(doc);
+    json        *node = NULL;
+    char        *before = json2string(snapshot, 0);
+    char        *str = NULL;
+
+    output->root = NULL;
+    json_output_destroy(output);
+
+    ASSERT_EQ(NULL, json_edit(&doc, "/a/x"));
+    ASSERT_EQ(NULL, json_edit(&doc, "/a/b/2"));
+    ASSERT_EQ(NULL, json_edit(&doc, "/a/b/01"));
+
+    node = json_edit(&doc, "/a/b/1");
+    ASSERT_NE(nullptr, node);
+    ASSERT_EQ(API_SUCCESS, json_object_put_number(node, "c", 2));
+    ASSERT_EQ(API_SUCCESS, json_object_put_string(json_edit(&doc, "/a"), "d/e", "y"));
+    ASSERT_TRUE(json_is_equal2string(json_edit(&doc, "/a/d~1e"), "y"));
+
+    // only the values on the path were copied
+    ASSERT_NE(snapshot, doc);
+    ASSERT_NE(json_object_get(snapshot, "a"), json_object_get(doc, "a"));
+    ASSERT_EQ(json_object_get(snapshot, "f"), json_object_get(doc, "f"));
+
+    str = json2string(snapshot, 0);
+    ASSERT_STREQ(before, str);
+    free(str);
+    str = json2string(doc, 0);
+    ASSERT_STREQ("{\"a\":{\"b\":[1.000000,{\"c\":2.000000}],\"d\\/e\":\"y\"},\"f\":[3.000000]}", str);
+    free(str);
+
+    // editing what is no longer shared copies nothing
+    node = json_object_get(doc, "a");
+    ASSERT_EQ(node, json_edit(&doc, "/a"));
+    ASSERT_EQ(doc, json_edit(&doc, ""));
+
+    json_destroy(snapshot);
+    ASSERT_EQ(API_SUCCESS, json_array_add_number(json_edit(&doc, "/f"), 0, 2));
+
+    free(before);
+    json_destroy(doc);
+}
+
+TEST(json_freezeTest, contract)
+{
+    const char         *json_str = "{\"name\": \"text\", \"n\": [1, 2], \"list\": [true, {\"a\": null}]}";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    json_output        *output = json_parse_ex(json_str, strlen(json_str), &options);
+    json               *doc = output->root;
+    json               *list = json_object_get(doc, "list");
+    json               *n = json_object_get(doc, "n");
+    json               *snapshot = NULL;
+    char               *str = NULL;
+    double              number = 0;
+
+    output->root = NULL;
+    json_output_destroy(output);
+
+    ASSERT_EQ(API_FAILURE, json_freeze(NULL));
+    ASSERT_EQ(API_SUCCESS, json_freeze(doc));
+    ASSERT_EQ(API_SUCCESS, json_freeze(doc));
+
+    // packed arrays stay packed, and readable
+    ASSERT_TRUE(n->flags & JSON_PACKED);
+    ASSERT_EQ(API_SUCCESS, json_array_get_number(n, 1, &number));
+    ASSERT_EQ(2, number);
+    ASSERT_EQ(API_FAILURE, json_array_unpack(n));
+
+    // nothing in the tree changes
+    ASSERT_EQ(API_FAILURE, json_object_put_string(doc, "name", "changed"));
+    ASSERT_EQ(API_FAILURE, json_array_add_number(n, 0, 0));
+    ASSERT_EQ(API_FAILURE, json_array_reserve(list, 10));
+    ASSERT_EQ(API_FAILURE, json_array_remove_at(list, 0));
+    ASSERT_EQ(API_FAILURE, json_array_swap_remove(list, 0));
+    ASSERT_EQ(API_FAILURE, json_array_append_boolean(list, false));
+    ASSERT_EQ(API_FAILURE, json_array_remove_boolean(list, true));
+    ASSERT_EQ(API_FAILURE, json_object_remove_member(json_array_get(list, 1), "a"));
+    ASSERT_EQ(API_FAILURE, json_object_swap_remove(json_array_get(list, 1), "a"));
+    ASSERT_EQ(doc, json_compact(doc, 0));
+    str = json2string(doc, 0);
+    ASSERT_STREQ("{\"name\":\"text\",\"n\":[1.000000,2.000000],\"list\":[true,{\"a\":null}]}", str);
+    free(str);
+
+    // not by editing it, which would free what the readers read
+    snapshot = doc;
+    ASSERT_EQ(NULL, json_edit(&snapshot, "/list/1"));
+    ASSERT_EQ(NULL, json_edit(&snapshot, ""));
+    ASSERT_EQ(doc, snapshot);
+    ASSERT_EQ(list, json_object_get(doc, "list"));
+    ASSERT_TRUE(json_is_equal2string(json_object_get(doc, "name"), "text"));
+
+    // but a new version can be made from a reference to it
+    snapshot = json_share(doc);
+    ASSERT_EQ(API_SUCCESS, json_object_put_number(json_edit(&snapshot, "/list/1"), "a", 1));
+    ASSERT_EQ(API_SUCCESS, json_freeze(snapshot));
+    ASSERT_EQ(n, json_object_get(snapshot, "n"));
+    str = json2string(snapshot, 0);
+    ASSERT_STREQ("{\"name\":\"text\",\"n\":[1.000000,2.000000],\"list\":[true,{\"a\":1.000000}]}", str);
+    free(str);
+
+    json_destroy(doc);
+    json_destroy(snapshot);
+}
+
+/*
+ * Read a frozen tree from many threads at once, run under ThreadSanitizer with
+ * make tsan to catch getters that write
+ */
+TEST(json_freezeTest, concurrent_readers)
+{
+    std::string         json_str = "{\"items\": [";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    json_output        *output = NULL;
+    json               *doc = NULL;
+    char               *expected = NULL;
+    std::vector<std::thread> readers;
+    std::vector<int>    failures(8, 0);
+
+    for (int i = 0; i < 100; i++)
+    {
+        json_str += (i ? "," : "") + std::string("{\"id\": ") + std::to_string(i)
+            + ", \"tags\": [\"a\", \"b\"], \"values\": [1, 2, 3]}";
+    }
+    json_str += "], \"count\": 100}";
+
+    output = json_parse_ex(json_str.c_str(), json_str.size(), &options);
+    doc = output->root;
+    output->root = NULL;
+    json_output_destroy(output);
+    ASSERT_EQ(API_SUCCESS, json_freeze(doc));
+    expected = json2string(doc, 0);
+
+    for (size_t t = 0; t < failures.size(); t++)
+    {
+        readers.emplace_back([doc, expected, &failures, t]()
+        {
+            for (int round = 0; round < 20; round++)
+            {
+                json   *items = json_object_get(doc, "items");
+                json   *mine = json_share(doc);
+                char   *str = json2string(mine, 0);
+                double  sum = 0;
+                size_t  written = 0;
+                double  values[3];
+
+                for (ssize_t i = 0; i < json_get_size(items); i++)
+                {
+                    json          *item = json_array_get(items, i);
+                    json_obj_iter  it = json_obj_iter_init(item);
+                    double         id = -1;
+
+                    for (obj_pair *pair = json_obj_next(&it); pair != json_obj_end(&it);
+                         pair = json_obj_next(&it))
+                    {
+                        if (json_is_equal2string(json_array_get(pair->value, 0), "a"))
+                            sum += 1;
+                    }
+                    json_object_get_number(item, "id", &id);
+                    json_array_get_numbers(json_object_get(item, "values"), values, 3, &written);
+                    sum += id + values[2] + written;
+                }
+
+                if (strcmp(str, expected) != 0 || sum != 4950 + 100 * 7)
+                    failures[t]++;
+                free(str);
+                json_destroy(mine);
+            }
+        });
+    }
+
+    for (std::thread &reader : readers)
+        reader.join();
+
+    for (int failed : failures)
+        ASSERT_EQ(0, failed);
+
+    free(expected);
+    json_destroy(doc);
+}
+
+TEST(json_memory_usageTest, basic)
+{
+    const char  *json_str = "{\"a\": [1, 2], \"bc\": \"xyz\"}";
+    json_output *output = json_parse(json_str);
+    json_memory  usage;
+
+    ASSERT_EQ(API_FAILURE, json_memory_usage(NULL, &usage));
+    ASSERT_EQ(API_SUCCESS, json_memory_usage(output->root, &usage));
+
+    ASSERT_EQ(3 * sizeof(json) + 2 * JSON_NODE_SIZE(JSON_TYPE_NUMBER) + 2 * sizeof(obj_pair),
+              usage.nodes);
+    ASSERT_EQ(5u, usage.keys);
+    ASSERT_EQ(4u, usage.strings);
+    ASSERT_EQ(4 * sizeof(void *), usage.containers);
+    ASSERT_LT(0u, usage.slack);
+
+    json_compact(output->root, 0);
+    ASSERT_EQ(API_SUCCESS, json_memory_usage(output->root, &usage));
+    ASSERT_EQ(0u, usage.slack);
+    ASSERT_EQ(usage.nodes + usage.keys + usage.strings + usage.containers, usage.total);
+
+    json_output_destroy(output);
+}
+
+/* ========== PACKED ARRAYS ========== */
+
+static json_output *parse_packed(const char *json_str)
+{
+    json_parse_options options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    return json_parse_ex(json_str, strlen(json_str), &options);
+}
+
+TEST(json_array_packedTest, numbers_are_read_in_place)
+{
+    json_output *output = parse_packed("[1.5, -2, 3e2, 7]");
+    json        *array = output->root;
+    double       number = 0;
+    char        *str = NULL;
+
+    ASSERT_EQ(JSON_PACKED, array->flags);
+    ASSERT_EQ(4, json_get_size(array));
+    ASSERT_EQ(-2, array->numbers[1]);
+
+    ASSERT_EQ(API_SUCCESS, json_array_get_number(array, 2, &number));
+    ASSERT_EQ(300, number);
+    ASSERT_EQ(API_FAILURE, json_array_get_number(array, 4, &number));
+    ASSERT_EQ(API_FAILURE, json_array_get_boolean(array, 0, (bool *) &number));
+    ASSERT_EQ(3, json_array_index_of_number(array, 7));
+    ASSERT_EQ(-1, json_array_index_of_number(array, 8));
+    ASSERT_EQ(-1, json_array_index_of_string(array, "7"));
+    ASSERT_TRUE(json_array_has_number(array, 1.5));
+
+    // numbers go in without unpacking
+    json_array_add_number(array, 0, 0);
+    json_array_append_number(array, 8);
+    json_array_remove_number(array, -2);
+    ASSERT_EQ(JSON_PACKED, array->flags);
+
+    str = json2string(array, 0);
+    ASSERT_STREQ("[0.000000,300.000000,7.000000,8.000000]", str);
+
+    free(str);
+    json_output_destroy(output);
+}
+
+TEST(json_array_packedTest, unpacked_when_needed)
+{
+    json_output *output = parse_packed("[[1, 2], [3, 4], [5, 6]]");
+    json        *root = output->root;
+    json        *value = NULL;
+    json        *snapshot = NULL;
+    char        *str = NULL;
+
+    ASSERT_EQ(0, root->flags);
+
+    // getters leave packed arrays alone
+    ASSERT_EQ(NULL, json_array_get(json_array_get(root, 1), 1));
+    ASSERT_EQ(NULL, json_array_get_elements(json_array_get(root, 2)));
+    ASSERT_EQ(JSON_PACKED, json_array_get(root, 1)->flags);
+
+    // another type of value
+    json_array_append_string(json_array_get(root, 0), "x");
+    // or when asked to
+    ASSERT_EQ(API_SUCCESS, json_array_unpack(json_array_get(root, 1)));
+    value = json_array_get(json_array_get(root, 1), 1);
+    ASSERT_TRUE(JSON_IS_NUMBER(value));
+    ASSERT_EQ(4, value->num_val);
+    ASSERT_EQ(API_SUCCESS, json_array_unpack(json_array_get(root, 1)));
+    ASSERT_EQ(API_FAILURE, json_array_unpack(root->elements[0]->elements[0]));
+
+    // not once shared
+    snapshot = json_share(json_array_get(root, 2));
+    ASSERT_EQ(API_FAILURE, json_array_unpack(snapshot));
+    json_destroy(snapshot);
+    ASSERT_EQ(JSON_PACKED, json_array_get(root, 2)->flags);
+    ASSERT_EQ(API_SUCCESS, json_array_unpack(json_array_get(root, 2)));
+
+    ASSERT_EQ(0, json_array_get(root, 0)->flags);
+    ASSERT_EQ(0, json_array_get(root, 1)->flags);
+    ASSERT_EQ(0, json_array_get(root, 2)->flags);
+
+    str = json2string(root, 0);
+    ASSERT_STREQ("[[1.000000,2.000000,\"x\"],[3.000000,4.000000],[5.000000,6.000000]]", str);
+
+    free(str);
+    json_output_destroy(output);
+}
+
+TEST(json_array_packedTest, edited_through)
+{
+    json_output *output = parse_packed("{\"n\": [1, 2, 3]}");
+    json        *doc = output->root;
+    json        *snapshot = json_share(doc);
+    json        *value = NULL;
+    char        *str = NULL;
+
+    output->root = NULL;
+    json_output_destroy(output);
+
+    // the copy on the path is unpacked, the shared array is left as it is
+    ASSERT_EQ(NULL, json_edit(&doc, "/n/3"));
+    value = json_edit(&doc, "/n/1");
+    ASSERT_TRUE(JSON_IS_NUMBER(value));
+    ASSERT_EQ(2, value->num_val);
+    ASSERT_EQ(0, json_object_get(doc, "n")->flags);
+    ASSERT_EQ(JSON_PACKED, json_object_get(snapshot, "n")->flags);
+    ASSERT_EQ(API_SUCCESS, json_array_add_string(json_edit(&doc, "/n"), 1, "two"));
+
+    str = json2string(snapshot, 0);
+    ASSERT_STREQ("{\"n\":[1.000000,2.000000,3.000000]}", str);
+    free(str);
+    str = json2string(doc, 0);
+    ASSERT_STREQ("{\"n\":[1.000000,\"two\",3.000000]}", str);
+
+    free(str);
+    json_destroy(snapshot);
+    json_destroy(doc);
+}
+
+TEST(json_array_packedTest, compact_and_memory_usage)
+{
+    json_output *output = parse_packed("{\"a\": [1, 2, 3], \"b\": [true]}");
+    json        *root = output->root;
+    json_memory  usage;
+    char        *before = json2string(root, 0);
+    char        *after = NULL;
+
+    ASSERT_EQ(API_SUCCESS, json_memory_usage(json_object_get(root, "a"), &usage));
+    ASSERT_EQ(sizeof(json), usage.nodes);
+    ASSERT_EQ(3 * sizeof(double), usage.containers);
+
+    root = json_compact(root, JSON_COMPACT_CONTIGUOUS);
+    output->root = NULL;
+    ASSERT_EQ(JSON_PACKED | JSON_FIXED_NODE | JSON_FIXED_BUF, json_object_get(root, "a")->flags);
+    after = json2string(root, 0);
+    ASSERT_STREQ(before, after);
+    free(after);
+
+    json_array_append_number(json_object_get(root, "a"), 4);
+    json_array_append_boolean(json_object_get(root, "a"), false);
+    after = json2string(root, 0);
+    ASSERT_STREQ("{\"a\":[1.000000,2.000000,3.000000,4.000000,false],\"b\":[true]}", after);
+
+    free(before);
+    free(after);
+    json_destroy(root);
+    json_output_destroy(output);
+}
+
 /* ========== PRINTING METHODS ========== */
 
 // simple array
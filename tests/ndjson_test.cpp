@@ -0,0 +1,179 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "parser.h"
+}
+
+TEST(json_ndjsonTest, records)
+{
+    const char  *ndjson_str = 
+        "{\"id\": 1}\n"
+        "[1, 2, 3]\r\n"
+        "\n"
+        "   \n"
+        "\"last\"";
+    json_ndjson *nd = json_ndjson_open(ndjson_str, strlen(ndjson_str));
+    json_record  record;
+    double       number = 0;
+
+    ASSERT_TRUE(json_ndjson_next(nd, &record));
+    ASSERT_EQ(JSON_ERROR_NONE, record.error);
+    ASSERT_EQ(1, record.line);
+    ASSERT_EQ(API_SUCCESS, json_object_get_number(record.root, "id", &number));
+    ASSERT_EQ(1, number);
+    json_destroy(record.root);
+
+    ASSERT_TRUE(json_ndjson_next(nd, &record));
+    ASSERT_EQ(JSON_ERROR_NONE, record.error);
+    ASSERT_EQ(2, record.line);
+    ASSERT_EQ(3, json_get_size(record.root));
+    json_destroy(record.root);
+
+    // blank lines are skipped
+    ASSERT_TRUE(json_ndjson_next(nd, &record));
+    ASSERT_EQ(JSON_ERROR_NONE, record.error);
+    ASSERT_EQ(5, record.line);
+    ASSERT_TRUE(json_is_equal2string(record.root, "last"));
+    json_destroy(record.root);
+
+    ASSERT_FALSE(json_ndjson_next(nd, &record));
+    ASSERT_FALSE(json_ndjson_next(nd, &record));
+
+    json_ndjson_close(nd);
+}
+
+TEST(json_ndjsonTest, errors_do_not_stop_the_stream)
+{
+    const char  *ndjson_str = "[1]\n[1, 2\n{\"a\": tru}\n[4]\n";
+    json_ndjson *nd = json_ndjson_open(ndjson_str, strlen(ndjson_str));
+    json_record  record;
+
+    ASSERT_TRUE(json_ndjson_next(nd, &record));
+    ASSERT_EQ(JSON_ERROR_NONE, record.error);
+    json_destroy(record.root);
+
+    ASSERT_TRUE(json_ndjson_next(nd, &record));
+    ASSERT_EQ(NULL, record.root);
+    ASSERT_EQ(JSON_ERROR_UNBALANCED_SQUARE_BRACKET, record.error);
+    ASSERT_EQ(2, record.line);
+
+    ASSERT_TRUE(json_ndjson_next(nd, &record));
+    ASSERT_EQ(NULL, record.root);
+    ASSERT_EQ(JSON_ERROR_INVALID_JSON, record.error);
+    ASSERT_EQ(3, record.line);
+    ASSERT_EQ(10, record.error_loc);
+    ASSERT_STREQ("JSON is invalid", json_error2string(record.error));
+
+    ASSERT_TRUE(json_ndjson_next(nd, &record));
+    ASSERT_EQ(JSON_ERROR_NONE, record.error);
+    ASSERT_EQ(4, record.line);
+    json_destroy(record.root);
+
+    ASSERT_FALSE(json_ndjson_next(nd, &record));
+    json_ndjson_close(nd);
+}
+
+static std::string make_ndjson(int lines)
+{
+    std::string ndjson_str;
+    int         i;
+
+    for (i = 0; i < lines; i++)
+    {
+        if (i % 97 == 13)
+            ndjson_str += "{\"id\": " + std::to_string(i) + ", \"broken\": [}\n";
+        else if (i % 50 == 7)
+            ndjson_str += "\n";
+        else
+            ndjson_str += "{\"id\": " + std::to_string(i) + ", \"tags\": [\"a\", \"b\"]}\n";
+    }
+    return ndjson_str;
+}
+
+static void assert_same_record(const json_record &expected, const json_record &record)
+{
+    char *exp_str = json2string(expected.root, 0);
+    char *str = json2string(record.root, 0);
+
+    ASSERT_EQ(expected.line, record.line);
+    ASSERT_EQ(expected.error, record.error);
+    ASSERT_EQ(expected.error_loc, record.error_loc);
+    if (exp_str)
+        ASSERT_STREQ(exp_str, str);
+    else
+        ASSERT_EQ(NULL, str);
+
+    free(exp_str);
+    free(str);
+}
+
+TEST(json_ndjson_parallelTest, ordered_like_serial)
+{
+    std::string           ndjson_str = make_ndjson(5000);
+    json_parallel_options options = { 4, 1000, 3, false };
+    json_ndjson          *serial = json_ndjson_open(ndjson_str.c_str(), ndjson_str.size());
+    json_ndjson          *parallel = json_ndjson_open_parallel(ndjson_str.c_str(),
+                                          ndjson_str.size(), &options);
+    json_record           expected, record;
+
+    while (json_ndjson_next(serial, &expected))
+    {
+        ASSERT_TRUE(json_ndjson_next(parallel, &record));
+        assert_same_record(expected, record);
+        json_destroy(expected.root);
+        json_destroy(record.root);
+    }
+    ASSERT_FALSE(json_ndjson_next(parallel, &record));
+
+    json_ndjson_close(serial);
+    json_ndjson_close(parallel);
+}
+
+TEST(json_ndjson_parallelTest, unordered_has_every_record)
+{
+    std::string             ndjson_str = make_ndjson(5000);
+    json_parallel_options   options = { 4, 1000, 0, true };
+    json_ndjson            *serial = json_ndjson_open(ndjson_str.c_str(), ndjson_str.size());
+    json_ndjson            *parallel = json_ndjson_open_parallel(ndjson_str.c_str(),
+                                            ndjson_str.size(), &options);
+    std::vector<json_record> records;
+    json_record             expected, record;
+    size_t                  i = 0;
+
+    while (json_ndjson_next(parallel, &record))
+    {
+        records.push_back(record);
+    }
+    std::sort(records.begin(), records.end(),
+        [](const json_record &a, const json_record &b) { return a.line < b.line; });
+
+    while (json_ndjson_next(serial, &expected))
+    {
+        ASSERT_LT(i, records.size());
+        assert_same_record(expected, records[i]);
+        json_destroy(expected.root);
+        json_destroy(records[i++].root);
+    }
+    ASSERT_EQ(records.size(), i);
+
+    json_ndjson_close(serial);
+    json_ndjson_close(parallel);
+}
+
+TEST(json_ndjson_parallelTest, close_early)
+{
+    std::string           ndjson_str = make_ndjson(5000);
+    json_parallel_options options = { 3, 500, 2, false };
+    json_ndjson          *parallel = json_ndjson_open_parallel(ndjson_str.c_str(),
+                                          ndjson_str.size(), &options);
+    json_record           record;
+
+    ASSERT_TRUE(json_ndjson_next(parallel, &record));
+    json_destroy(record.root);
+
+    // the records still queued are destroyed
+    json_ndjson_close(parallel);
+}
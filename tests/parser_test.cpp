@@ -1,4 +1,8 @@
 #include "gtest/gtest.h"
+#include <string>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
 
 extern "C" {
     #include "parser.h"
@@ -88,10 +92,10 @@ TEST(parserTest, general_primitives)
     int          i = 0;
     const char  *primitives[] = { "3.14", "true", "null", "\"json\"" };
     json         results[] = {
-        { JSON_TYPE_NUMBER, 0, 0, { .num_val = 3.14} },
-        { JSON_TYPE_BOOLEAN, 0, 0, { .bool_val = true } },
-        { JSON_TYPE_NULL, 0, 0, { .string_val = NULL } },
-        { JSON_TYPE_STRING, 0, 0, { .string_val = (unsigned char *) "json" } },
+        { .type = JSON_TYPE_NUMBER, .flags = 0, .refs = 0, .num_val = 3.14, .cnt = 0, .alloced = 0 },
+        { .type = JSON_TYPE_BOOLEAN, .flags = 0, .refs = 0, .bool_val = true, .cnt = 0, .alloced = 0 },
+        { .type = JSON_TYPE_NULL, .flags = 0, .refs = 0, .string_val = NULL, .cnt = 0, .alloced = 0 },
+        { .type = JSON_TYPE_STRING, .flags = 0, .refs = 0, .string_val = (unsigned char *) "json", .cnt = 0, .alloced = 0 },
     };
     int          num_prims = sizeof(primitives) / sizeof(char *);
     json_output *output = NULL;
@@ -688,4 +692,1255 @@ TEST(parserTest, nested_recursion_depth_exceeded)
     ASSERT_EQ(JSON_ERROR_PARSER_MAX_DEPTH_EXCEEDED, output->error);
 
     json_output_destroy(output);
-}
\ No newline at end of file
+}
+
+/* VALIDATION */
+class ValidateTest : public ::testing::TestWithParam<const char *> {
+
+};
+
+TEST_P(ValidateTest, same_result_as_json_parse)
+{
+    const char  *json_str = GetParam();
+    json_output *output = json_parse(json_str);
+    int          error = -1;
+    size_t       error_loc = 1;
+    bool         valid;
+
+    valid = json_validate(json_str, strlen(json_str), &error, &error_loc);
+
+    ASSERT_EQ(output->error == JSON_ERROR_NONE, valid);
+    ASSERT_EQ(output->error, error);
+    ASSERT_EQ(json_parser_get_error_loc(output), error_loc);
+
+    json_output_destroy(output);
+}
+
+INSTANTIATE_TEST_CASE_P(parserTests,
+    ValidateTest,
+    ::testing::Values(
+        "[1, {\"k0\": [2, {\"k1\":3, \"k2\":4}, 5]},6]",
+        "{\"a\": \"new\\u00A0line\", \"b\": [true, false, null], \"c\": -3.1e2}",
+        "  [ ]  ",
+        "   ",
+        "[",
+        "[1 2]",
+        "[1] x",
+        "{\"a\" 1}",
+        "{1: 2}",
+        "{\"a\": [}",
+        "[\"hello, world]",
+        "[\"\\m\"]",
+        "[\"\037\"]",
+        "[03]",
+        "[3e]",
+        "[tru]",
+        "[\"\xC3\"]"
+        ));
+
+
+TEST(json_validateTest, null_input)
+{
+    int error = -1;
+    size_t error_loc = 1;
+
+    ASSERT_FALSE(json_validate(NULL, 0, &error, &error_loc));
+    ASSERT_EQ(JSON_ERROR_EMPTY_INPUT, error);
+    ASSERT_EQ(0u, error_loc);
+}
+
+
+TEST(json_validateTest, buffer_is_not_nul_terminated)
+{
+    const char buf[] = { '[', '1', ',', '2', ']', '[', '1' };
+    int        error = -1;
+    size_t     error_loc = 1;
+
+    ASSERT_TRUE(json_validate(buf, 5, &error, &error_loc));
+    ASSERT_EQ(JSON_ERROR_NONE, error);
+
+    ASSERT_FALSE(json_validate(buf, 4, &error, &error_loc));
+    ASSERT_EQ(JSON_ERROR_UNBALANCED_SQUARE_BRACKET, error);
+
+    // trailing input after the document
+    ASSERT_FALSE(json_validate(buf, sizeof(buf), NULL, NULL));
+}
+
+
+/* SELECTION */
+static void assert_same_json(const char *expected_str, json *js)
+{
+    json_output *expected = json_parse(expected_str);
+    char        *exp_str = json2string(expected->root, 0);
+    char        *js_str = json2string(js, 0);
+
+    ASSERT_EQ(JSON_ERROR_NONE, expected->error);
+    ASSERT_STREQ(exp_str, js_str);
+
+    free(exp_str);
+    free(js_str);
+    json_output_destroy(expected);
+}
+
+TEST(json_parse_selectTest, selected_paths)
+{
+    const char  *json_str = 
+        "{\"meta\": {\"id\": 7, \"tags\": [\"a\", \"b\"]},"
+        " \"items\": [{\"price\": 1, \"name\": \"x\"}, {\"name\": \"y\"}, {\"price\": 3}],"
+        " \"other\": \"zzz\"}";
+    const char  *paths[] = { "/meta/id", "/items/*/price" };
+    json_output *output = json_parse_select(json_str, strlen(json_str), paths, 2);
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json(
+        "{\"meta\": {\"id\": 7}, \"items\": [{\"price\": 1}, {}, {\"price\": 3}]}",
+        output->root);
+
+    json_output_destroy(output);
+}
+
+TEST(json_parse_selectTest, whole_subtrees_and_indexes)
+{
+    const char  *json_str = "[{\"a\": [1, 2], \"b\": 2}, {\"a\": {\"c\": null}}, 3]";
+    const char  *paths[] = { "/1/a", "/*/b", "/2" };
+    json_output *output = json_parse_select(json_str, strlen(json_str), paths, 3);
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json("[{\"b\": 2}, {\"a\": {\"c\": null}}, 3]", output->root);
+
+    json_output_destroy(output);
+}
+
+TEST(json_parse_selectTest, escaped_keys)
+{
+    const char  *json_str = "{\"a/b\": 1, \"\\u0063\": 2, \"d\": 3}";
+    const char  *paths[] = { "/a~1b", "/c" };
+    json_output *output = json_parse_select(json_str, strlen(json_str), paths, 2);
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json("{\"a/b\": 1, \"c\": 2}", output->root);
+
+    json_output_destroy(output);
+}
+
+TEST(json_parse_selectTest, whole_document)
+{
+    const char  *json_str = "{\"a\": [1, {\"b\": true}]}";
+    const char  *paths[] = { "" };
+    json_output *output = json_parse_select(json_str, strlen(json_str), paths, 1);
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json(json_str, output->root);
+
+    json_output_destroy(output);
+}
+
+TEST(json_parse_selectTest, skipped_values_are_validated)
+{
+    const char  *json_str = "{\"a\": 1, \"b\": [1, 2, tru]}";
+    const char  *paths[] = { "/a" };
+    json_output *output = json_parse_select(json_str, strlen(json_str), paths, 1);
+    json_output *expected = json_parse(json_str);
+
+    ASSERT_EQ(NULL, output->root);
+    ASSERT_EQ(expected->error, output->error);
+    ASSERT_EQ(json_parser_get_error_loc(expected), json_parser_get_error_loc(output));
+
+    json_output_destroy(expected);
+    json_output_destroy(output);
+}
+
+
+/* FILTERS */
+static const char *records_json =
+    "[{\"id\": \"A\", \"region\": {\"id\": \"SSF\"}, \"pop\": 10},"
+    " {\"id\": \"B\", \"region\": {\"id\": \"EAS\"}, \"pop\": 30},"
+    " {\"id\": \"C\", \"region\": {\"id\": \"S\\u0053F\"}, \"pop\": 50},"
+    " {\"id\": \"D\", \"region\": null},"
+    " 7]";
+
+TEST(json_parse_filterTest, string_field)
+{
+    json_filter  filter = { "/region/id", JSON_FILTER_EQ, JSON_TYPE_STRING, { .num_val = 0 } };
+    json_output *output = NULL;
+
+    filter.string_val = "SSF";
+    output = json_parse_filter(records_json, strlen(records_json), &filter);
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json(
+        "[{\"id\": \"A\", \"region\": {\"id\": \"SSF\"}, \"pop\": 10},"
+        " {\"id\": \"C\", \"region\": {\"id\": \"SSF\"}, \"pop\": 50}]",
+        output->root);
+
+    json_output_destroy(output);
+}
+
+TEST(json_parse_filterTest, number_field)
+{
+    json_filter  filter = { "/pop", JSON_FILTER_GT, JSON_TYPE_NUMBER, { .num_val = 20 } };
+    json_output *output = json_parse_filter(records_json, strlen(records_json), &filter);
+    char        *id = NULL;
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    ASSERT_EQ(2, json_get_size(output->root));
+    json_object_get_string(json_array_get(output->root, 0), "id", &id);
+    ASSERT_STREQ("B", id);
+    json_object_get_string(json_array_get(output->root, 1), "id", &id);
+    ASSERT_STREQ("C", id);
+
+    json_output_destroy(output);
+}
+
+TEST(json_parse_filterTest, record_itself)
+{
+    const char  *json_str = "[1, 5, \"5\", 9, 2]";
+    json_filter  filter = { "", JSON_FILTER_LE, JSON_TYPE_NUMBER, { .num_val = 5 } };
+    json_output *output = json_parse_filter(json_str, strlen(json_str), &filter);
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json("[1, 5, 2]", output->root);
+
+    json_output_destroy(output);
+}
+
+TEST(json_parse_filterTest, escaped_strings)
+{
+    const char  *json_str = "[{\"id\": \"S\\u0053F\"}, {\"id\": \"a\\nb\"}, {\"id\": \"\\u00e9\"},"
+                            " {\"id\": \"SS\\u0046X\"}, {\"id\": \"S\\\"\"}]";
+    json_filter  filter = { "/id", JSON_FILTER_EQ, JSON_TYPE_STRING, { .num_val = 0 } };
+    json_output *output = NULL;
+
+    filter.string_val = "SSF";
+    output = json_parse_filter(json_str, strlen(json_str), &filter);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json("[{\"id\": \"SSF\"}]", output->root);
+    json_output_destroy(output);
+
+    filter.op = JSON_FILTER_GT;
+    output = json_parse_filter(json_str, strlen(json_str), &filter);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json("[{\"id\": \"a\\nb\"}, {\"id\": \"\\u00e9\"}, {\"id\": \"SSFX\"}]", output->root);
+    json_output_destroy(output);
+
+    filter.op = JSON_FILTER_LT;
+    output = json_parse_filter(json_str, strlen(json_str), &filter);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json("[{\"id\": \"S\\\"\"}]", output->root);
+    json_output_destroy(output);
+}
+
+TEST(json_parse_filterTest, errors)
+{
+    const char  *json_str = "[{\"pop\": 1}, {\"pop\": 2,}]";
+    json_filter  filter = { "/pop", JSON_FILTER_EQ, JSON_TYPE_NUMBER, { .num_val = 1 } };
+    json_output *output = json_parse_filter(json_str, strlen(json_str), &filter);
+    json_output *expected = json_parse(json_str);
+
+    ASSERT_EQ(NULL, output->root);
+    ASSERT_EQ(expected->error, output->error);
+    ASSERT_EQ(json_parser_get_error_loc(expected), json_parser_get_error_loc(output));
+    json_output_destroy(expected);
+    json_output_destroy(output);
+
+    // only arrays can be filtered
+    output = json_parse_filter("{\"pop\": 1}", 10, &filter);
+    ASSERT_EQ(NULL, output->root);
+    ASSERT_EQ(JSON_ERROR_INVALID_JSON, output->error);
+    json_output_destroy(output);
+}
+
+/* small chunks so that even these documents are split between the workers */
+static const json_parallel_options parallel_options = { 4, 8, 0, false };
+
+TEST(json_parse_parallelTest, same_result_as_json_parse)
+{
+    const char *json_strs[] = {
+        "[1, \"two\", {\"a\": [3, 4], \"b,]\": \"x\\\",\"}, [5, [6]], null, true,"
+        " \"\\u00e9\", -7.5e3, {}, [], \"]\", 8]",
+        "  [ {\"id\": 1}  ,\n{\"id\": 2} , {\"id\": 3}, {\"id\": 4} ]  \n",
+        "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18]",
+        "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,, 15, 16, 17, 18]",
+        "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,]",
+        "[\"abcdefgh\", \"ijklmnop\", \"qrstuvwx\", \"yz\" \"0\"]",
+        "[[1, 2, 3, 4], [5, 6, 7, 8], [9, 10, 11, 12}, [13]]",
+        "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18] 19",
+        "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18",
+        "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, tru]",
+        "{\"a\": [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14]}",
+        "[]",
+        "",
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(json_strs) / sizeof(json_strs[0]); i++)
+    {
+        json_output *expected = json_parse(json_strs[i]);
+        json_output *output = json_parse_parallel(json_strs[i], strlen(json_strs[i]),
+                                                  &parallel_options);
+
+        ASSERT_EQ(expected->error, output->error) << json_strs[i];
+        ASSERT_EQ(expected->buffer_idx, output->buffer_idx) << json_strs[i];
+        if (expected->root)
+        {
+            char *expected_str = json2string(expected->root, 0);
+            char *str = json2string(output->root, 0);
+
+            ASSERT_STREQ(expected_str, str);
+            free(expected_str);
+            free(str);
+        }
+        else
+        {
+            ASSERT_EQ(NULL, output->root);
+        }
+
+        json_output_destroy(expected);
+        json_output_destroy(output);
+    }
+}
+
+TEST(json_parse_parallelTest, large_array)
+{
+    std::string  json_str = "[";
+    json_output *output;
+    double       number = 0;
+    int          i;
+
+    for (i = 0; i < 100000; i++)
+    {
+        json_str += (i ? ", " : "") + std::to_string(i);
+    }
+    json_str += "]";
+
+    output = json_parse_parallel(json_str.c_str(), json_str.size(), &parallel_options);
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    ASSERT_EQ(100000, json_get_size(output->root));
+    for (i = 0; i < 100000; i += 997)
+    {
+        ASSERT_EQ(API_SUCCESS, json_array_get_number(output->root, i, &number));
+        ASSERT_EQ(i, number);
+    }
+
+    json_output_destroy(output);
+}
+
+TEST(json_parse_fileTest, parse_file)
+{
+    char         path[] = "/tmp/tson_test_XXXXXX";
+    const char  *json_str = "{\"a\": [1, 2, {\"b\": null}], \"c\": \"d\"}\n";
+    int          fd = mkstemp(path);
+    json_output *output;
+
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ((ssize_t) strlen(json_str), write(fd, json_str, strlen(json_str)));
+    close(fd);
+
+    output = json_parse_file(path, JSON_FILE_POPULATE | JSON_FILE_SEQUENTIAL);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json(json_str, output->root);
+    json_output_destroy(output);
+
+    // the file is not NUL terminated, trailing input is still caught
+    fd = open(path, O_WRONLY | O_APPEND);
+    ASSERT_EQ(1, write(fd, "x", 1));
+    close(fd);
+
+    output = json_parse_file(path, 0);
+    ASSERT_EQ(NULL, output->root);
+    ASSERT_EQ(JSON_ERROR_INVALID_JSON, output->error);
+    json_output_destroy(output);
+
+    unlink(path);
+}
+
+TEST(json_parse_fileTest, io_errors)
+{
+    char         path[] = "/tmp/tson_test_XXXXXX";
+    int          fd = mkstemp(path);
+    json_output *output;
+
+    close(fd);
+    output = json_parse_file(path, 0);
+    ASSERT_EQ(JSON_ERROR_EMPTY_INPUT, output->error);
+    json_output_destroy(output);
+
+    unlink(path);
+    output = json_parse_file(path, 0);
+    ASSERT_EQ(NULL, output->root);
+    ASSERT_EQ(JSON_ERROR_IO, output->error);
+    json_output_destroy(output);
+}
+
+static FILE *tmpfile_with(const char *str)
+{
+    FILE *fp = tmpfile();
+
+    fputs(str, fp);
+    rewind(fp);
+    return fp;
+}
+
+TEST(json_parse_fdTest, array_elements)
+{
+    const char  *json_str = " [{\"name\": \"caf\xc3\xa9 \\u00e9\", \"n\": -12.5e1}, [true, null],"
+                            " \"\xe2\x82\xac\xe2\x82\xac\xe2\x82\xac\", 1234567890, []]  ";
+    json_output *expected = json_parse(json_str);
+    FILE        *fp = tmpfile_with(json_str);
+    // a small buffer has to be refilled in the middle of tokens and characters
+    json_stream *stream = json_parse_fd(fileno(fp), 8);
+    json        *value = NULL;
+    int          i = 0;
+
+    while (json_stream_next(stream, &value))
+    {
+        char *expected_str = json2string(json_array_get(expected->root, i++), 0);
+        char *str = json2string(value, 0);
+
+        ASSERT_STREQ(expected_str, str);
+        free(expected_str);
+        free(str);
+        json_destroy(value);
+    }
+    ASSERT_EQ(JSON_ERROR_NONE, json_stream_get_error(stream));
+    ASSERT_EQ(json_get_size(expected->root), i);
+    ASSERT_FALSE(json_stream_next(stream, &value));
+
+    json_stream_close(stream);
+    json_output_destroy(expected);
+    fclose(fp);
+}
+
+TEST(json_parse_fdTest, root_value)
+{
+    FILE        *fp = tmpfile_with("\n{\"a\": [1, 2], \"b\": \"c\"}\n\n");
+    json_stream *stream = json_parse_fp(fp, 0);
+    json        *value = NULL;
+    char        *str = NULL;
+
+    // a root that is not an array comes whole
+    ASSERT_TRUE(json_stream_next(stream, &value));
+    str = json2string(value, 0);
+    ASSERT_STREQ("{\"a\":[1.000000,2.000000],\"b\":\"c\"}", str);
+    free(str);
+    json_destroy(value);
+
+    ASSERT_FALSE(json_stream_next(stream, &value));
+    ASSERT_EQ(JSON_ERROR_NONE, json_stream_get_error(stream));
+
+    json_stream_close(stream);
+    fclose(fp);
+}
+
+TEST(json_parse_fdTest, errors)
+{
+    const char *json_strs[] = {
+        "",
+        "  \n",
+        "[1, 2",
+        "[1, 2,]",
+        "[1, 2] 3",
+        "1 2 3",
+        "{\"a\": 1} {\"b\": 2}",
+        "\"abc\"\n[]",
+        "[1, \"abc\x01\"]",
+        "[1, {\"a\" 2}]",
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(json_strs) / sizeof(json_strs[0]); i++)
+    {
+        json_output *expected = json_parse(json_strs[i]);
+        FILE        *fp = tmpfile_with(json_strs[i]);
+        json_stream *stream = json_parse_fd(fileno(fp), 8);
+        json        *value = NULL;
+
+        while (json_stream_next(stream, &value))
+        {
+            json_destroy(value);
+        }
+        ASSERT_EQ(expected->error, json_stream_get_error(stream)) << json_strs[i];
+        ASSERT_EQ(json_parser_get_error_loc(expected),
+                  json_stream_get_error_loc(stream)) << json_strs[i];
+
+        json_stream_close(stream);
+        json_output_destroy(expected);
+        fclose(fp);
+    }
+
+    // reading fails
+    json_stream *stream = json_parse_fd(-1, 0);
+    json        *value = NULL;
+
+    ASSERT_FALSE(json_stream_next(stream, &value));
+    ASSERT_EQ(JSON_ERROR_IO, json_stream_get_error(stream));
+    json_stream_close(stream);
+}
+
+/*
+ * Needs about 5GB of memory, so it only runs with TSON_LARGE_TESTS set
+ */
+TEST(parserTest, document_over_4GB)
+{
+    const size_t  str_len = 1 << 20;
+    const size_t  num_strs = 4400;
+    std::string   str(str_len, 'x');
+    std::string   doc = "[";
+    size_t        error_loc = 0;
+    int           error = 0;
+    json_output  *output;
+    char         *selected = NULL;
+    const char   *path = "/4300";
+    size_t        i;
+
+    if (!getenv("TSON_LARGE_TESTS"))
+        return;
+
+    doc.reserve(num_strs * (str_len + 3) + 2);
+    for (i = 0; i < num_strs; i++)
+    {
+        str[0] = 'a' + i % 26;
+        doc += "\"" + str + "\",";
+    }
+    doc.back() = ']';
+    ASSERT_GT(doc.size(), (size_t) 1 << 32);
+
+    ASSERT_TRUE(json_validate(doc.c_str(), doc.size(), &error, &error_loc));
+
+    output = json_parse_select(doc.c_str(), doc.size(), &path, 1);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    ASSERT_EQ(API_SUCCESS, json_array_get_string(output->root, 0, &selected));
+    ASSERT_EQ(str_len, strlen(selected));
+    ASSERT_EQ('a' + 4300 % 26, selected[0]);
+    json_output_destroy(output);
+
+    // the error is reported past 4GB
+    doc.back() = '}';
+    ASSERT_FALSE(json_validate(doc.c_str(), doc.size(), &error, &error_loc));
+    ASSERT_EQ(JSON_ERROR_UNBALANCED_SQUARE_BRACKET, error);
+    ASSERT_EQ(doc.size(), error_loc);
+}
+
+TEST(json_parse_exTest, trusted_round_trip)
+{
+    const char         *json_str = "{\"name\": \"caf\xc3\xa9 \\\"au\\\" \\u00e9\\n\", \"list\": [1, -2.5,"
+                                   " true, null, \"\", {\"a/b\": \"\\\\\"}], \"empty\": {}}";
+    json_parse_options  options = { JSON_PARSE_TRUSTED, NULL, 0 };
+    json_output        *expected = json_parse(json_str);
+    char               *str = json2string(expected->root, 0);
+    json_output        *output = json_parse_ex(str, strlen(str), &options);
+
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json(json_str, output->root);
+
+    free(str);
+    json_output_destroy(output);
+    json_output_destroy(expected);
+}
+
+TEST(json_parse_exTest, trusted_input_cut_short)
+{
+    const char         *json_strs[] = { "[\"abc", "[\"abc\\", "[\"abc\"", "{\"a\": \"b\"" };
+    json_parse_options  options = { JSON_PARSE_TRUSTED, NULL, 0 };
+    size_t              i;
+
+    for (i = 0; i < sizeof(json_strs) / sizeof(json_strs[0]); i++)
+    {
+        json_output *expected = json_parse(json_strs[i]);
+        json_output *output = json_parse_ex(json_strs[i], strlen(json_strs[i]), &options);
+
+        ASSERT_EQ(NULL, output->root);
+        ASSERT_EQ(expected->error, output->error) << json_strs[i];
+        ASSERT_EQ(json_parser_get_error_loc(expected),
+                  json_parser_get_error_loc(output)) << json_strs[i];
+
+        json_output_destroy(expected);
+        json_output_destroy(output);
+    }
+}
+
+TEST(json_parse_exTest, checks_are_skipped_only_when_trusted)
+{
+    const char         *json_str = "[\"a\tb\"]";
+    std::string         nested = std::string(JSON_PARSER_MAX_DEPTH + 1, '[')
+                                 + std::string(JSON_PARSER_MAX_DEPTH + 1, ']');
+    json_parse_options  options = { JSON_PARSE_TRUSTED, NULL, 0 };
+    json_output        *output;
+
+    output = json_parse_ex(json_str, strlen(json_str), NULL);
+    ASSERT_EQ(JSON_ERROR_STRING_HAS_CONTROL_CHAR, output->error);
+    json_output_destroy(output);
+
+    output = json_parse_ex(json_str, strlen(json_str), &options);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    ASSERT_TRUE(json_is_equal2string(json_array_get(output->root, 0), "a\tb"));
+    json_output_destroy(output);
+
+    output = json_parse_ex(nested.c_str(), nested.size(), NULL);
+    ASSERT_EQ(JSON_ERROR_PARSER_MAX_DEPTH_EXCEEDED, output->error);
+    json_output_destroy(output);
+
+    output = json_parse_ex(nested.c_str(), nested.size(), &options);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    json_output_destroy(output);
+}
+
+TEST(json_parser_ctxTest, same_output_as_json_parse)
+{
+    const char      *json_strs[] = { "{\"a\": [1, \"two\", {\"three\": null}], \"b\": \"\\u00e9t\\u00e9\"}",
+                                     "[true, false, [], {}]", "\"abc", "" };
+    json_parser_ctx *ctx = json_parser_ctx_create();
+    size_t           i;
+
+    for (i = 0; i < sizeof(json_strs) / sizeof(json_strs[0]); i++)
+    {
+        json_output *expected = json_parse(json_strs[i]);
+        json_output *output = json_parser_ctx_parse(ctx, json_strs[i], strlen(json_strs[i]), NULL);
+
+        ASSERT_EQ(expected->error, output->error) << json_strs[i];
+        ASSERT_EQ(expected->buffer_idx, output->buffer_idx) << json_strs[i];
+        if (expected->root)
+            assert_same_json(json_strs[i], output->root);
+        else
+            ASSERT_EQ(NULL, output->root);
+
+        json_output_destroy(expected);
+    }
+
+    ASSERT_EQ(JSON_ERROR_EMPTY_INPUT, json_parser_ctx_parse(ctx, NULL, 0, NULL)->error);
+    json_parser_ctx_destroy(ctx);
+}
+
+TEST(json_parser_ctxTest, recycles_deep_tree)
+{
+    json_parser_ctx *ctx = json_parser_ctx_create();
+    json_output     *output = json_parser_ctx_parse(ctx, "{}", 2, NULL);
+    json            *js = output->root;
+
+    // deeper than the stack would allow a recursive recycle
+    for (int i = 0; i < 1000000; i++)
+    {
+        json *child = JSON_OBJECT_CREATE();
+
+        json_object_put_string(js, "s", "abc");
+        json_object_put_complex_value(js, "next", child);
+        js = child;
+    }
+
+    output = json_parser_ctx_parse(ctx, "[1, {\"a\": \"b\"}]", 15, NULL);
+    assert_same_json("[1, {\"a\": \"b\"}]", output->root);
+    json_parser_ctx_destroy(ctx);
+}
+
+TEST(json_parser_ctxTest, reparsing_does_not_allocate)
+{
+    std::string      json_str = "[";
+    json_parser_ctx *ctx = json_parser_ctx_create();
+    size_t           mallocs;
+    int              i;
+
+    for (i = 0; i < 100; i++)
+    {
+        json_str += (i ? ", " : "") + std::string("{\"id\": ") + std::to_string(i)
+                    + ", \"name\": \"record number " + std::to_string(i) + "\", \"tags\": [\"x\", \"y\"]}";
+    }
+    json_str += "]";
+
+    // the first documents fill the pool, after that it has all it needs
+    for (i = 0; i < 2; i++)
+    {
+        ASSERT_EQ(JSON_ERROR_NONE, json_parser_ctx_parse(ctx, json_str.c_str(), json_str.size(), NULL)->error);
+    }
+    mallocs = ctx->pool.mallocs;
+
+    for (i = 0; i < 3; i++)
+    {
+        json_output *output = json_parser_ctx_parse(ctx, json_str.c_str(), json_str.size(), NULL);
+
+        ASSERT_EQ(JSON_ERROR_NONE, output->error);
+        ASSERT_EQ(100, json_get_size(output->root));
+        ASSERT_EQ(mallocs, ctx->pool.mallocs);
+    }
+
+    json_parser_ctx_destroy(ctx);
+}
+
+TEST(json_parser_ctxTest, kept_tree_is_an_ordinary_tree)
+{
+    const char      *json_str = "{\"a\": [1, 2], \"b\": \"text\"}";
+    json_parser_ctx *ctx = json_parser_ctx_create();
+    json_output     *output = json_parser_ctx_parse(ctx, json_str, strlen(json_str), NULL);
+    json            *root = output->root;
+
+    output->root = NULL;
+    ASSERT_EQ(JSON_ERROR_NONE, json_parser_ctx_parse(ctx, json_str, strlen(json_str), NULL)->error);
+
+    json_array_append_string(json_object_get(root, "a"), "three");
+    json_object_put_string(root, "b", "longer text than before");
+    json_object_put_boolean(root, "c", true);
+    assert_same_json("{\"a\": [1, 2, \"three\"], \"b\": \"longer text than before\", \"c\": true}", root);
+
+    json_destroy(root);
+    json_parser_ctx_destroy(ctx);
+}
+
+static void assert_exact_size(json *js)
+{
+    size_t i;
+
+    if (JSON_IS_ARRAY(js))
+    {
+        ASSERT_EQ(js->cnt, js->alloced);
+        for (i = 0; i < js->cnt; i++)
+            assert_exact_size(js->elements[i]);
+    }
+    else if (JSON_IS_OBJECT(js))
+    {
+        ASSERT_EQ(js->cnt, js->alloced);
+        for (i = 0; i < js->cnt; i++)
+            assert_exact_size(js->members[i]->value);
+    }
+}
+
+TEST(json_parse_exTest, exact_size_containers)
+{
+    std::string         json_str = "{\"empty\": [], \"none\": {}, \"s\": \"[,{\\\"]\", \"list\": [";
+    json_parse_options  options = { JSON_PARSE_EXACT_SIZE, NULL, 0 };
+    json_output        *output;
+    json               *list;
+    int                 i;
+
+    for (i = 0; i < 1000; i++)
+    {
+        json_str += (i ? ", " : "") + std::string("{\"id\": ") + std::to_string(i) + ", \"v\": [1, [2], \",\"]}";
+    }
+    json_str += "]}";
+
+    output = json_parse_ex(json_str.c_str(), json_str.size(), &options);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json(json_str.c_str(), output->root);
+    list = json_object_get(output->root, "list");
+    ASSERT_EQ(1000, json_get_size(list));
+
+    // the root and the list close too far ahead to be counted, their records do
+    assert_exact_size(json_object_get(output->root, "empty"));
+    assert_exact_size(json_object_get(output->root, "none"));
+    for (i = 0; i < 1000; i++)
+        assert_exact_size(json_array_get(list, i));
+    json_output_destroy(output);
+
+    // a document that fits the window is counted whole
+    json_str = "{\"a\": [1, [2, 3], {\"b\": \"]\\\\\", \"c\": [\"\\\"[\"]}], \"d\": {}}";
+    output = json_parse_ex(json_str.c_str(), json_str.size(), &options);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json(json_str.c_str(), output->root);
+    assert_exact_size(output->root);
+    json_output_destroy(output);
+
+    // deeper than the count follows, those grow as usual
+    json_str = std::string(100, '[') + "1, 2" + std::string(100, ']');
+    output = json_parse_ex(json_str.c_str(), json_str.size(), &options);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    assert_same_json(json_str.c_str(), output->root);
+    json_output_destroy(output);
+}
+
+TEST(json_parse_exTest, exact_size_invalid_input)
+{
+    const char         *json_strs[] = { "[1, [2, 3]", "[1, 2]]", "{\"a\": [}", "[1 2, 3]", "[,]", "[\"]\", 1" };
+    json_parse_options  options = { JSON_PARSE_EXACT_SIZE, NULL, 0 };
+    size_t              i;
+
+    for (i = 0; i < sizeof(json_strs) / sizeof(json_strs[0]); i++)
+    {
+        json_output *expected = json_parse(json_strs[i]);
+        json_output *output = json_parse_ex(json_strs[i], strlen(json_strs[i]), &options);
+
+        ASSERT_EQ(expected->error, output->error) << json_strs[i];
+        ASSERT_EQ(json_parser_get_error_loc(expected),
+                  json_parser_get_error_loc(output)) << json_strs[i];
+
+        json_output_destroy(expected);
+        json_output_destroy(output);
+    }
+}
+
+/*
+ * An allocator that tags its blocks, so that a block it did not allocate given
+ * to it, or a block of its own given to free, is caught
+ */
+typedef struct counting_allocator
+{
+    std::atomic<long> live;
+    std::atomic<long> total;
+    long              fail_at; // allocations fail once total reaches it, -1 for never
+} counting_allocator;
+
+#define COUNTING_TAG    0x6a736f6e616c6c63UL
+
+static void *counting_malloc(size_t size, void *ctx)
+{
+    counting_allocator *counter = (counting_allocator *) ctx;
+    unsigned long      *block;
+
+    if (counter->fail_at >= 0 && counter->total >= counter->fail_at)
+        return NULL;
+
+    block = (unsigned long *) malloc(size + 16);
+    block[0] = COUNTING_TAG;
+    counter->live++;
+    counter->total++;
+    return block + 2;
+}
+
+static void counting_free(void *ptr, void *ctx)
+{
+    counting_allocator *counter = (counting_allocator *) ctx;
+    unsigned long      *block = (unsigned long *) ptr - 2;
+
+    if (block[0] != COUNTING_TAG)
+        abort();
+    block[0] = 0;
+    counter->live--;
+    free(block);
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *ctx)
+{
+    counting_allocator *counter = (counting_allocator *) ctx;
+    unsigned long      *block = NULL;
+
+    if (!ptr)
+        return counting_malloc(size, ctx);
+    block = (unsigned long *) ptr - 2;
+    if (block[0] != COUNTING_TAG)
+        abort();
+    if (counter->fail_at >= 0 && counter->total >= counter->fail_at)
+        return NULL;
+    if (!(block = (unsigned long *) realloc(block, size + 16)))
+        return NULL;
+    return block + 2;
+}
+
+TEST(json_allocatorTest, every_allocation_goes_through_it)
+{
+    counting_allocator     counter;
+    json_allocator         allocator = { counting_malloc, counting_realloc, counting_free, &counter };
+    const char            *json_str = "{\"a\": [1, \"two\", {\"three\": null}], \"b\": \"\\u00e9t\\u00e9\"}";
+    std::string            array = "[";
+    const char            *paths[] = { "/a/2" };
+    json_filter            filter = { "/n", JSON_FILTER_GT, JSON_TYPE_NUMBER, { .num_val = 1 } };
+    json_parse_options     options = { JSON_PARSE_EXACT_SIZE, NULL, 0 };
+    json_parallel_options  parallel = { 2, 64, 0, false };
+    json_parser_ctx       *ctx;
+    json_ndjson           *nd;
+    json_record            record;
+    json_stream           *stream;
+    json                  *value;
+    json_output           *output;
+    FILE                  *fp;
+    char                  *str;
+    int                    i;
+
+    for (i = 0; i < 100; i++)
+        array += (i ? ", " : "") + std::string("{\"n\": ") + std::to_string(i) + "}";
+    array += "]";
+
+    counter.live = 0;
+    counter.total = 0;
+    counter.fail_at = -1;
+    json_set_allocator(&allocator);
+
+    json_output_destroy(json_parse(json_str));
+    json_output_destroy(json_parse_ex(json_str, strlen(json_str), &options));
+    json_output_destroy(json_parse_select(json_str, strlen(json_str), paths, 1));
+    json_output_destroy(json_parse_filter(array.c_str(), array.size(), &filter));
+    json_output_destroy(json_parse_parallel(array.c_str(), array.size(), &parallel));
+
+    ctx = json_parser_ctx_create();
+    json_parser_ctx_parse(ctx, json_str, strlen(json_str), NULL);
+    json_parser_ctx_parse(ctx, array.c_str(), array.size(), NULL);
+    json_parser_ctx_destroy(ctx);
+
+    nd = json_ndjson_open("{\"a\": 1}\n[2]\n", 13);
+    while (json_ndjson_next(nd, &record))
+        json_destroy(record.root);
+    json_ndjson_close(nd);
+
+    fp = tmpfile_with(array.c_str());
+    stream = json_parse_fp(fp, 16);
+    while (json_stream_next(stream, &value))
+        json_destroy(value);
+    json_stream_close(stream);
+    fclose(fp);
+
+    output = json_parse(json_str);
+    output->root = json_compact(output->root, JSON_COMPACT_CONTIGUOUS);
+    json_array_append_string(json_object_get(output->root, "a"), "four");
+    json_object_put_number(output->root, "c", 3);
+    str = json2string(output->root, 4);
+    json_free(str);
+    json_output_destroy(output);
+
+    json_set_allocator(NULL);
+
+    ASSERT_LT(0, counter.total);
+    ASSERT_EQ(0, counter.live);
+}
+
+TEST(json_allocatorTest, filter_discards_without_allocating)
+{
+    counting_allocator  counter;
+    json_allocator      allocator = { counting_malloc, counting_realloc, counting_free, &counter };
+    const char         *escaped = "[{\"id\": \"\\u0041\"}, {\"id\": \"B\\tC\"}]";
+    const char         *plain = "[{\"id\": \"A\"}, {\"id\": \"BC\"}]";
+    json_filter         filter = { "/id", JSON_FILTER_EQ, JSON_TYPE_STRING, { .num_val = 0 } };
+    long                plain_total;
+
+    counter.live = 0;
+    counter.total = 0;
+    counter.fail_at = -1;
+    filter.string_val = "none";
+    json_set_allocator(&allocator);
+
+    // decoding the escapes to compare them takes no memory of the parse
+    json_output_destroy(json_parse_filter(plain, strlen(plain), &filter));
+    plain_total = counter.total;
+    json_output_destroy(json_parse_filter(escaped, strlen(escaped), &filter));
+
+    json_set_allocator(NULL);
+    ASSERT_EQ(2 * plain_total, counter.total);
+    ASSERT_EQ(0, counter.live);
+}
+
+TEST(json_allocatorTest, destroy_async)
+{
+    counting_allocator  counter;
+    json_allocator      allocator = { counting_malloc, counting_realloc, counting_free, &counter };
+    std::string         json_str = "[";
+    int                 i;
+
+    counter.live = 0;
+    counter.total = 0;
+    counter.fail_at = -1;
+
+    for (i = 0; i < 10000; i++)
+        json_str += (i ? ", " : "") + std::string("{\"id\": ") + std::to_string(i) + ", \"tags\": [\"a\", \"b\"]}";
+    json_str += "]";
+
+    // trees are freed by the thread with the allocator they were built with
+    json_use_allocator(&allocator);
+    for (i = 0; i < 10; i++)
+    {
+        json_output *output = json_parse(json_str.c_str());
+
+        ASSERT_EQ(JSON_ERROR_NONE, output->error);
+        json_destroy_async(output->root);
+        output->root = NULL;
+        json_output_destroy(output);
+    }
+    json_destroy_async(NULL);
+    json_destroy_async(json_create(JSON_TYPE_NUMBER));
+    json_use_allocator(NULL);
+
+    json_destroy_async_wait();
+    ASSERT_EQ(0, counter.live);
+    ASSERT_LT(10 * 10000, counter.total);
+}
+
+TEST(json_allocatorTest, api_allocation_failures)
+{
+    counting_allocator  counter;
+    json_allocator      allocator = { counting_malloc, counting_realloc, counting_free, &counter };
+    const char         *json_str = "{\"a\": {\"b\": [1, 2], \"c\": \"x\"}, \"d\": {\"b\": null}}";
+    const char         *paths[] = { "/a/*", "/*/b" };
+    long                fail_at;
+
+    // every allocation in turn is the first to fail
+    for (fail_at = 0; ; fail_at++)
+    {
+        bool         done = true;
+        json        *object = NULL;
+        json_output *output = NULL;
+        char        *str = NULL;
+
+        counter.live = 0;
+        counter.total = 0;
+        counter.fail_at = fail_at;
+        json_use_allocator(&allocator);
+
+        if ((object = json_create(JSON_TYPE_OBJECT)))
+        {
+            ssize_t put = 0;
+
+            // a put that fails leaves the object as it was
+            for (int i = 0; i < 12; i++)
+            {
+                std::string key = "key" + std::to_string(i);
+
+                if (json_object_put_string(object, key.c_str(), "value") == API_SUCCESS)
+                    put++;
+                else
+                    done = false;
+            }
+            ASSERT_EQ(put, json_get_size(object)) << fail_at;
+
+            if ((str = json2string(object, 2)))
+                json_free(str);
+            else
+                done = false;
+            json_destroy(object);
+        }
+        else
+        {
+            done = false;
+        }
+
+        if ((output = json_parse_select(json_str, strlen(json_str), paths, 2)))
+        {
+            if (output->error != JSON_ERROR_NONE)
+            {
+                ASSERT_EQ(JSON_ERROR_MEMORY, output->error) << fail_at;
+                done = false;
+            }
+            json_output_destroy(output);
+        }
+        else
+        {
+            done = false;
+        }
+
+        json_use_allocator(NULL);
+        ASSERT_EQ(0, counter.live) << fail_at;
+        if (done)
+            break;
+    }
+
+    ASSERT_LT(20, fail_at);
+}
+
+TEST(json_allocatorTest, per_parse_allocator)
+{
+    counting_allocator  counter;
+    json_allocator      allocator = { counting_malloc, counting_realloc, counting_free, &counter };
+    const char         *json_str = "{\"a\": [1, \"two\", {\"three\": null}]}";
+    json_parse_options  options = { 0, &allocator, 0 };
+    json_output        *output;
+    json               *plain;
+
+    counter.live = 0;
+    counter.total = 0;
+    counter.fail_at = -1;
+
+    output = json_parse_ex(json_str, strlen(json_str), &options);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    ASSERT_LT(0, counter.live);
+    ASSERT_EQ(NULL, json_use_allocator(NULL));
+
+    // other values still come from malloc
+    plain = json_create(JSON_TYPE_STRING);
+    json_destroy(plain);
+
+    // the tree is changed and destroyed with its allocator in effect
+    json_use_allocator(&allocator);
+    json_object_put_string(output->root, "b", "text");
+    json_output_destroy(output);
+    json_use_allocator(NULL);
+
+    ASSERT_EQ(0, counter.live);
+}
+
+TEST(json_parse_exTest, memory_limit)
+{
+    std::string         json_str = "[";
+    json_parse_options  options = { 0, NULL, 0 };
+    json_memory         usage;
+    json_output        *output;
+    int                 i;
+
+    for (i = 0; i < 1000; i++)
+        json_str += (i ? ", " : "") + std::string("{\"id\": ") + std::to_string(i) + ", \"name\": \"some name\"}";
+    json_str += "]";
+
+    output = json_parse_ex(json_str.c_str(), json_str.size(), &options);
+    ASSERT_EQ(API_SUCCESS, json_memory_usage(output->root, &usage));
+    json_output_destroy(output);
+
+    options.max_bytes = usage.total / 2;
+    output = json_parse_ex(json_str.c_str(), json_str.size(), &options);
+    ASSERT_EQ(JSON_ERROR_MEMORY_LIMIT, output->error);
+    ASSERT_EQ(NULL, output->root);
+    ASSERT_LT(0u, json_parser_get_error_loc(output));
+    ASSERT_GT(json_str.size() / 2 + 100, json_parser_get_error_loc(output));
+    json_output_destroy(output);
+
+    options.max_bytes = 2 * usage.total;
+    output = json_parse_ex(json_str.c_str(), json_str.size(), &options);
+    ASSERT_EQ(JSON_ERROR_NONE, output->error);
+    json_output_destroy(output);
+}
+
+TEST(json_parse_exTest, allocation_failures)
+{
+    counting_allocator  counter;
+    json_allocator      allocator = { counting_malloc, counting_realloc, counting_free, &counter };
+    const char         *json_str = "{\"a\": [1, \"two\", {\"three\": null}], \"b\": \"\\u00e9t\\u00e9\", \"c\": true}";
+    json_parse_options  options = { JSON_PARSE_EXACT_SIZE, &allocator, 0 };
+    json_output        *output = NULL;
+    long                fail_at;
+
+    // every allocation in turn is the first to fail
+    for (fail_at = 0; ; fail_at++)
+    {
+        counter.live = 0;
+        counter.total = 0;
+        counter.fail_at = fail_at;
+
+        output = json_parse_ex(json_str, strlen(json_str), &options);
+        if (!output)
+            continue;
+
+        json_use_allocator(&allocator);
+        if (output->error == JSON_ERROR_NONE)
+        {
+            json_output_destroy(output);
+            json_use_allocator(NULL);
+            ASSERT_EQ(0, counter.live);
+            break;
+        }
+
+        ASSERT_EQ(JSON_ERROR_MEMORY, output->error) << fail_at;
+        ASSERT_EQ(NULL, output->root);
+        json_output_destroy(output);
+        json_use_allocator(NULL);
+        ASSERT_EQ(0, counter.live) << fail_at;
+    }
+
+    ASSERT_LT(10, fail_at);
+}
+
+TEST(json_parse_exTest, packed_numbers)
+{
+    const char *json_str = "{\"s\": [1.5, -2, 3e2], \"mixed\": [1, 2, \"x\", 4], \"empty\": [],"
+                           " \"lead\": [\"a\", 1], \"nested\": [[1, 2], [3]]}";
+    int         flags[] = { JSON_PARSE_PACK_NUMBERS, JSON_PARSE_PACK_NUMBERS | JSON_PARSE_EXACT_SIZE,
+                            JSON_PARSE_PACK_NUMBERS | JSON_PARSE_TRUSTED };
+    size_t      i;
+
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+    {
+        json_parse_options  options = { flags[i], NULL, 0 };
+        json_output        *output = json_parse_ex(json_str, strlen(json_str), &options);
+        json               *root = output->root;
+
+        ASSERT_EQ(JSON_ERROR_NONE, output->error);
+        ASSERT_EQ(JSON_PACKED, json_object_get(root, "s")->flags);
+        ASSERT_EQ(0, json_object_get(root, "mixed")->flags);
+        ASSERT_EQ(0, json_object_get(root, "empty")->flags);
+        ASSERT_EQ(0, json_object_get(root, "lead")->flags);
+        ASSERT_EQ(0, json_object_get(root, "nested")->flags);
+        ASSERT_EQ(JSON_PACKED, json_object_get(root, "nested")->elements[1]->flags);
+        assert_same_json(json_str, root);
+        json_output_destroy(output);
+    }
+}
+
+TEST(json_parse_exTest, packed_numbers_errors)
+{
+    const char         *json_strs[] = { "[1, 2", "[1, -]", "[1, 2 3]", "[1, 2,]", "[1, tru]" };
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    size_t              i;
+
+    for (i = 0; i < sizeof(json_strs) / sizeof(json_strs[0]); i++)
+    {
+        json_output *expected = json_parse(json_strs[i]);
+        json_output *output = json_parse_ex(json_strs[i], strlen(json_strs[i]), &options);
+
+        ASSERT_EQ(expected->error, output->error) << json_strs[i];
+        ASSERT_EQ(json_parser_get_error_loc(expected),
+                  json_parser_get_error_loc(output)) << json_strs[i];
+
+        json_output_destroy(expected);
+        json_output_destroy(output);
+    }
+}
+
+TEST(json_parse_exTest, packed_numbers_memory)
+{
+    std::string         json_str = "[";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, NULL, 0 };
+    json_output        *generic, *packed;
+    json_memory         generic_usage, packed_usage;
+    json_parser_ctx    *ctx = json_parser_ctx_create();
+    int                 i;
+
+    for (i = 0; i < 100000; i++)
+        json_str += (i ? ", " : "") + std::to_string(i * 0.25);
+    json_str += "]";
+
+    generic = json_parse(json_str.c_str());
+    packed = json_parse_ex(json_str.c_str(), json_str.size(), &options);
+    ASSERT_EQ(JSON_ERROR_NONE, packed->error);
+    ASSERT_EQ(JSON_PACKED, packed->root->flags);
+    ASSERT_EQ(99999, json_array_index_of_number(packed->root, 99999 * 0.25));
+
+    json_compact(generic->root, 0);
+    json_compact(packed->root, 0);
+    json_memory_usage(generic->root, &generic_usage);
+    json_memory_usage(packed->root, &packed_usage);
+    ASSERT_EQ(100000 * sizeof(double), packed_usage.containers);
+    ASSERT_EQ(sizeof(json) + packed_usage.containers, packed_usage.total);
+    ASSERT_LE(3 * packed_usage.containers, generic_usage.total);
+
+    // packed arrays go back to a context's pool
+    for (i = 0; i < 3; i++)
+    {
+        json_output *output = json_parser_ctx_parse(ctx, json_str.c_str(), json_str.size(), &options);
+
+        ASSERT_EQ(JSON_ERROR_NONE, output->error);
+        ASSERT_EQ(JSON_PACKED, output->root->flags);
+        ASSERT_EQ(100000, json_get_size(output->root));
+    }
+
+    json_parser_ctx_destroy(ctx);
+    json_output_destroy(generic);
+    json_output_destroy(packed);
+}
+
+TEST(json_parse_exTest, packed_numbers_allocation_failures)
+{
+    counting_allocator  counter;
+    json_allocator      allocator = { counting_malloc, counting_realloc, counting_free, &counter };
+    const char         *json_str = "[[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, null], [1, 2]]";
+    json_parse_options  options = { JSON_PARSE_PACK_NUMBERS, &allocator, 0 };
+    json_output        *output = NULL;
+    long                fail_at;
+
+    for (fail_at = 0; ; fail_at++)
+    {
+        counter.live = 0;
+        counter.total = 0;
+        counter.fail_at = fail_at;
+
+        output = json_parse_ex(json_str, strlen(json_str), &options);
+        if (!output)
+            continue;
+
+        json_use_allocator(&allocator);
+        if (output->error == JSON_ERROR_NONE)
+        {
+            json_output_destroy(output);
+            json_use_allocator(NULL);
+            ASSERT_EQ(0, counter.live);
+            break;
+        }
+
+        ASSERT_EQ(JSON_ERROR_MEMORY, output->error) << fail_at;
+        json_output_destroy(output);
+        json_use_allocator(NULL);
+        ASSERT_EQ(0, counter.live) << fail_at;
+    }
+
+    ASSERT_LT(15, fail_at);
+}